@@ -0,0 +1,90 @@
+// Benchmark of the versions of PulseGenModule::process(). Runs a number of
+// instances with polyphonic triggers of different densities and prints the
+// time per process() call of each version, including writing the trigger
+// input:
+//   scalar   one channel at a time, before SIMD (PulseGenScalar.hpp)
+//   SIMD     four channels at a time with lane masks (PulseGenSimd.hpp)
+//   current  the module as it is now, which also counts whole samples and
+//            skips groups of channels without pulses
+// The speedup is that of SIMD over scalar.
+//
+//   pulsegen-bench [frames [instances]]
+
+#include "../src/PulseGenerator.cpp"
+#include "PulseGenScalar.hpp"
+#include "PulseGenSimd.hpp"
+#include "StandInEngine.hpp"
+
+Plugin *pluginInstance = NULL;
+
+struct Scenario {
+	const char *name;
+	int channels;
+	int period; // samples between triggers on each channel, 0 for none
+};
+
+static const Scenario scenarios[] = {
+	{"16 ch, idle", 16, 0},
+	{"16 ch, trigger every 0.2s", 16, 8820},
+	{"16 ch, trigger every 64 samples", 16, 64},
+	{"4 ch, trigger every 0.2s", 4, 8820},
+	{"1 ch, trigger every 0.2s", 1, 8820},
+};
+
+// As if cables were connected to the trigger input and both outputs.
+template <class M>
+static std::vector<M*> createModules(int numModules, int channels) {
+	std::vector<M*> modules;
+	for(int k = 0; k < numModules; k++) {
+		M *m = new M();
+		m->inputs[M::TRIG_INPUT].channels = channels;
+		m->outputs[M::GATE_OUTPUT].channels = 1;
+		m->outputs[M::FINISH_OUTPUT].channels = 1;
+		modules.push_back(m);
+	}
+	return modules;
+}
+
+// Nanoseconds per process() call.
+template <class M>
+static double measure(const Scenario &scenario, int64_t numFrames, int numModules) {
+	std::vector<M*> modules = createModules<M>(numModules, scenario.channels);
+	Module::ProcessArgs args;
+	args.sampleRate = 44100.f;
+	args.sampleTime = 1.f / args.sampleRate;
+	const uint64_t start = standInNow();
+	for(int64_t frame = 0; frame < numFrames; frame++) {
+		args.frame = frame;
+		for(int k = 0; k < numModules; k++) {
+			Input &trig = modules[k]->inputs[M::TRIG_INPUT];
+			for(int c = 0; c < scenario.channels; c++) {
+				// a 10 sample trigger, spread out over the period per channel and module
+				const bool high = scenario.period > 0 && (frame + 7 * c + 13 * k) % scenario.period < 10;
+				trig.voltages[c] = high ? 10.f : 0.f;
+			}
+			modules[k]->process(args);
+		}
+	}
+	const uint64_t ns = standInNow() - start;
+	for(M *m : modules) {
+		delete m;
+	}
+	return (double) ns / (numFrames * numModules);
+}
+
+int main(int argc, char **argv) {
+	const int64_t numFrames = argc > 1 ? std::max(atoll(argv[1]), 1LL) : 200000;
+	const int numModules = argc > 2 ? std::max(atoi(argv[2]), 1) : 32;
+	contextSet(new Context());
+	random::init();
+
+	printf("%lld frames, %d instances, ns per process()\n", (long long) numFrames, numModules);
+	printf("%-34s %8s %8s %8s %8s\n", "", "scalar", "SIMD", "speedup", "current");
+	for(const Scenario &scenario : scenarios) {
+		const double before = measure<scalar::PulseGenModule>(scenario, numFrames, numModules);
+		const double after = measure<simd4::PulseGenModule>(scenario, numFrames, numModules);
+		const double current = measure<PulseGenModule>(scenario, numFrames, numModules);
+		printf("%-34s %8.1f %8.1f %7.2fx %8.1f\n", scenario.name, before, after, before / after, current);
+	}
+	return 0;
+}
@@ -0,0 +1,50 @@
+// Check of the pulse durations of Pulse Generator in logarithmic mode against
+// std::pow(), over the whole range of the duration knob and the CV amount.
+// Prints the largest relative error of both and exits with 1 if it's 1e-5 or
+// more.
+//
+//   pulsegen-duration-check
+
+#include "../src/PulseGenerator.cpp"
+
+Plugin *pluginInstance = NULL;
+
+static const double maxError = 1e-5;
+static const int steps = 10000;
+
+int main(int argc, char **argv) {
+	contextSet(new Context());
+	PulseGenModule *m = new PulseGenModule();
+	m->params[PulseGenModule::LIN_LOG_MODE_PARAM].setValue(1.f);
+	Module::ProcessArgs args;
+	args.sampleRate = 44100.f;
+	args.sampleTime = 1.f / args.sampleRate;
+	args.frame = 0;
+
+	double durationError = 0.0, cvError = 0.0;
+	for(int i = 0; i <= steps; i++) {
+		// the same value of the knob and of the CV amount, with both signs
+		const float knob = 10.f * i / steps;
+		const float cvAmount = (i % 2 ? -1.f : 1.f) * i / steps;
+		m->params[PulseGenModule::GATE_LENGTH_PARAM].setValue(knob);
+		m->params[PulseGenModule::CV_AMT_PARAM].setValue(cvAmount);
+		m->process(args);
+		args.frame++;
+
+		const double exponent = rescale(knob, 0.f, 10.f, MIN_EXPONENT, MAX_EXPONENT);
+		const double duration = std::pow(10.0, exponent);
+		durationError = std::max(durationError, std::fabs(m->gate_base_duration / duration - 1.0));
+
+		const double cvExponent = rescale(std::fabs(cvAmount), 0.f, 1.f, MIN_EXPONENT, MAX_EXPONENT);
+		const double cvScale = std::pow(10.0, cvExponent - 1.0) * signum(cvAmount);
+		if(cvScale != 0.0) {
+			cvError = std::max(cvError, std::fabs(m->cv_scale / cvScale - 1.0));
+		}
+	}
+	delete m;
+
+	const bool failed = durationError >= maxError || cvError >= maxError;
+	printf("largest relative error: duration %.3g, CV scale %.3g\n", durationError, cvError);
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
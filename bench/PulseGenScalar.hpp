@@ -0,0 +1,184 @@
+#pragma once
+#include "plugin.hpp"
+
+// PulseGenModule as it was before its channels were processed four at a time
+// with SIMD, minus the widget, for comparing against the later versions in
+// PulseGenBench.cpp. Kept as it was apart from the namespace. Util.hpp can
+// only be included once, so include this after ../src/PulseGenerator.cpp.
+namespace scalar {
+
+const float MIN_EXPONENT = -3.0f;
+const float MAX_EXPONENT = 1.0f;
+
+// based on PulseGeneraotr in include/util/digital.hpp
+struct CustomPulseGenerator {
+	float time;
+	float triggerDuration;
+	bool finished; // the output is the inverse of this
+
+	CustomPulseGenerator() {
+		reset();
+	}
+	/** Immediately resets the state to LOW */
+	void reset() {
+		time = 0.f;
+		triggerDuration = 0.f;
+		finished = true;
+	}
+	/** Advances the state by `deltaTime`. Returns whether the pulse is in the HIGH state. */
+	bool process(float deltaTime) {
+		time += deltaTime;
+		if(!finished) finished = time >= triggerDuration;
+		return !finished;
+	}
+	/** Begins a trigger with the given `triggerDuration`. */
+	void trigger(float triggerDuration) {
+		// retrigger even with a shorter duration
+		time = 0.f;
+		finished = false;
+		this->triggerDuration = triggerDuration;
+	}
+};
+
+
+// the module is called PulseGenModule to avoid confusion with dsp::PulseGenerator
+struct PulseGenModule : Module {
+	enum ParamIds {
+		GATE_LENGTH_PARAM,
+		CV_AMT_PARAM,
+		LIN_LOG_MODE_PARAM,
+		NUM_PARAMS
+	};
+	enum InputIds {
+		TRIG_INPUT,
+		GATE_LENGTH_INPUT,
+		NUM_INPUTS
+	};
+	enum OutputIds {
+		GATE_OUTPUT,
+		FINISH_OUTPUT,
+		NUM_OUTPUTS
+	};
+	enum LightIds {
+		GATE_LIGHT,
+		FINISH_LIGHT,
+		NUM_LIGHTS
+	};
+
+	// not using SIMD here, doesn't seem to affect performance much
+	dsp::SchmittTrigger inputTrigger[MAX_POLY_CHANNELS], finishTrigger[MAX_POLY_CHANNELS];
+	CustomPulseGenerator gateGenerator[MAX_POLY_CHANNELS], finishTriggerGenerator[MAX_POLY_CHANNELS];
+	float gate_base_duration = 0.5f; // gate duration without CV
+	float gate_duration;
+	bool realtimeUpdate = true; // whether to display gate_duration or gate_base_duration
+	float cv_scale = 0.f; // cv_scale = +- 1 -> 10V CV changes duration by +-10s
+	bool allowRetrigger = true; // whether to allow the pulse to be retriggered if it is already outputting
+
+	PulseGenModule() {
+		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
+
+		//TODO: consider overriding ParamQuantity::getDisplayValueString
+		configParam(PulseGenModule::GATE_LENGTH_PARAM, 0.f, 10.f,
+					// 0.5s in log scale
+					//rescale(-0.30103f, MIN_EXPONENT, MAX_EXPONENT, 0.f,10.f)
+					5.f // 0.1s in log mode, 5s in lin mode
+					, "Pulse duration");
+		configSwitch(PulseGenModule::LIN_LOG_MODE_PARAM, 0.f, 1.f, 1.f, "Duration mod mode", {"Linear", "Logarithmic"});
+		configParam(PulseGenModule::CV_AMT_PARAM, -1.f, 1.f, 0.f, "CV amount");
+
+		configInput(TRIG_INPUT, "Trigger");
+		configInput(GATE_LENGTH_INPUT, "Gate length CV modulation");
+		configOutput(GATE_OUTPUT, "Gate");
+		configOutput(FINISH_OUTPUT, "Finish trigger");
+
+		gate_duration = gate_base_duration;
+	}
+
+	void process(const ProcessArgs &args) override;
+
+	json_t *dataToJson() override {
+		json_t *root = json_object();
+		json_object_set_new(root, "realtimeUpdate", json_boolean(realtimeUpdate));
+		json_object_set_new(root, "allowRetrigger", json_boolean(allowRetrigger));
+		return root;
+	}
+
+	void dataFromJson(json_t *root) override {
+		json_t *realtimeUpdate_J = json_object_get(root, "realtimeUpdate");
+		json_t *allowRetrigger_J = json_object_get(root, "allowRetrigger");
+		if(realtimeUpdate_J) {
+			realtimeUpdate = json_boolean_value(realtimeUpdate_J);
+		}
+		if(allowRetrigger_J) {
+			allowRetrigger = json_boolean_value(allowRetrigger_J);
+		}
+	}
+
+};
+
+void PulseGenModule::process(const ProcessArgs &args) {
+	float deltaTime = args.sampleTime;
+	const int channels = inputs[TRIG_INPUT].getChannels();
+
+	// handle duration knob and CV
+	float knob_value = params[GATE_LENGTH_PARAM].getValue();
+	float cv_amt = params[CV_AMT_PARAM].getValue();
+	float cv_voltage = inputs[GATE_LENGTH_INPUT].getVoltage();
+
+	if(params[LIN_LOG_MODE_PARAM].getValue() < 0.5f) {
+		// linear mode
+		cv_scale = cv_amt;
+		gate_base_duration = knob_value;
+	} else {
+		// logarithmic mode
+		float exponent = rescale(knob_value,
+				0.f, 10.f, MIN_EXPONENT, MAX_EXPONENT);
+
+		float cv_exponent = rescale(fabs(cv_amt), 0.f, 1.f,
+				MIN_EXPONENT, MAX_EXPONENT);
+
+		// decrease exponent by one so that 10V maps to 1.0 (100%) CV.
+		cv_scale = powf(10.0f, cv_exponent - 1.f) * signum(cv_amt); // take sign into account
+
+		gate_base_duration = powf(10.0f, exponent);
+	}
+	//TODO: make duration polyphonic? how to display it?
+	gate_duration = clamp(gate_base_duration + cv_voltage * cv_scale, 0.f, 10.f);
+
+	for(int c = 0; c < channels; c++) {
+
+		bool triggered = inputTrigger[c].process(rescale(inputs[TRIG_INPUT].getVoltage(c),
+					0.1f, 2.f, 0.f, 1.f));
+
+		if(triggered && gate_duration > 0.f) {
+			if(gateGenerator[c].finished || allowRetrigger) {
+				gateGenerator[c].trigger(gate_duration);
+			}
+		}
+
+		// update trigger duration even in the middle of a trigger
+		gateGenerator[c].triggerDuration = gate_duration;
+
+		bool gate = gateGenerator[c].process(deltaTime);
+
+		if(finishTrigger[c].process(gate ? 0.f : 1.f)) {
+			finishTriggerGenerator[c].trigger(1.e-3f);
+		}
+
+		float gate_v = gate ? 10.0f : 0.0f;
+		float finish_v = finishTriggerGenerator[c].process(deltaTime) ? 10.f : 0.f;
+		outputs[GATE_OUTPUT].setVoltage(gate_v, c);
+		outputs[FINISH_OUTPUT].setVoltage(finish_v, c);
+
+		//TODO: fix lights for polyphonic mode...
+		lights[GATE_LIGHT].setSmoothBrightness(gate_v, deltaTime);
+		lights[FINISH_LIGHT].setSmoothBrightness(finish_v, deltaTime);
+
+	}
+
+	outputs[GATE_OUTPUT].setChannels(channels);
+	outputs[FINISH_OUTPUT].setChannels(channels);
+
+}
+
+} // namespace scalar
@@ -0,0 +1,192 @@
+#pragma once
+#include "plugin.hpp"
+
+// PulseGenModule as it was when its channels were first processed four at a
+// time with SIMD, with float time accumulation, minus the widget. For
+// comparing against the scalar version before it and the current version in
+// PulseGenBench.cpp. Kept as it was apart from the namespace. Util.hpp can
+// only be included once, so include this after ../src/PulseGenerator.cpp.
+namespace simd4 {
+
+using simd::float_4;
+
+const float MIN_EXPONENT = -3.0f;
+const float MAX_EXPONENT = 1.0f;
+
+// based on PulseGeneraotr in include/util/digital.hpp, but processes four
+// channels at a time. Each lane of the vectors is one channel, and the flags
+// are lane masks, so there are no per-channel branches.
+struct CustomPulseGenerator {
+	float_4 time;
+	float_4 triggerDuration;
+	float_4 finished; // the output is the inverse of this
+
+	CustomPulseGenerator() {
+		reset();
+	}
+	/** Immediately resets the state to LOW */
+	void reset() {
+		time = 0.f;
+		triggerDuration = 0.f;
+		finished = float_4::mask();
+	}
+	/** Advances the state by `deltaTime`. Returns a mask of the lanes in the HIGH state. */
+	float_4 process(float deltaTime) {
+		time += deltaTime;
+		// once finished, a lane stays finished until it's triggered again
+		finished |= time >= triggerDuration;
+		return ~finished;
+	}
+	/** Begins a trigger with the given `triggerDuration` on the lanes set in `mask`. */
+	void trigger(float_4 mask, float triggerDuration) {
+		// retrigger even with a shorter duration
+		time = simd::ifelse(mask, 0.f, time);
+		finished &= ~mask;
+		this->triggerDuration = simd::ifelse(mask, triggerDuration, this->triggerDuration);
+	}
+};
+
+
+// the module is called PulseGenModule to avoid confusion with dsp::PulseGenerator
+struct PulseGenModule : Module {
+	enum ParamIds {
+		GATE_LENGTH_PARAM,
+		CV_AMT_PARAM,
+		LIN_LOG_MODE_PARAM,
+		NUM_PARAMS
+	};
+	enum InputIds {
+		TRIG_INPUT,
+		GATE_LENGTH_INPUT,
+		NUM_INPUTS
+	};
+	enum OutputIds {
+		GATE_OUTPUT,
+		FINISH_OUTPUT,
+		NUM_OUTPUTS
+	};
+	enum LightIds {
+		GATE_LIGHT,
+		FINISH_LIGHT,
+		NUM_LIGHTS
+	};
+
+	// channels are processed four at a time, element i holds channels 4i..4i+3
+	dsp::TSchmittTrigger<float_4> inputTrigger[MAX_POLY_CHANNELS / 4];
+	float_4 lastGate[MAX_POLY_CHANNELS / 4] = {}; // for detecting the end of the pulse
+	CustomPulseGenerator gateGenerator[MAX_POLY_CHANNELS / 4], finishTriggerGenerator[MAX_POLY_CHANNELS / 4];
+	float gate_base_duration = 0.5f; // gate duration without CV
+	float gate_duration;
+	bool realtimeUpdate = true; // whether to display gate_duration or gate_base_duration
+	float cv_scale = 0.f; // cv_scale = +- 1 -> 10V CV changes duration by +-10s
+	bool allowRetrigger = true; // whether to allow the pulse to be retriggered if it is already outputting
+
+	PulseGenModule() {
+		config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
+
+		//TODO: consider overriding ParamQuantity::getDisplayValueString
+		configParam(PulseGenModule::GATE_LENGTH_PARAM, 0.f, 10.f,
+					// 0.5s in log scale
+					//rescale(-0.30103f, MIN_EXPONENT, MAX_EXPONENT, 0.f,10.f)
+					5.f // 0.1s in log mode, 5s in lin mode
+					, "Pulse duration");
+		configSwitch(PulseGenModule::LIN_LOG_MODE_PARAM, 0.f, 1.f, 1.f, "Duration mod mode", {"Linear", "Logarithmic"});
+		configParam(PulseGenModule::CV_AMT_PARAM, -1.f, 1.f, 0.f, "CV amount");
+
+		configInput(TRIG_INPUT, "Trigger");
+		configInput(GATE_LENGTH_INPUT, "Gate length CV modulation");
+		configOutput(GATE_OUTPUT, "Gate");
+		configOutput(FINISH_OUTPUT, "Finish trigger");
+
+		gate_duration = gate_base_duration;
+	}
+
+	void process(const ProcessArgs &args) override;
+
+	json_t *dataToJson() override {
+		json_t *root = json_object();
+		json_object_set_new(root, "realtimeUpdate", json_boolean(realtimeUpdate));
+		json_object_set_new(root, "allowRetrigger", json_boolean(allowRetrigger));
+		return root;
+	}
+
+	void dataFromJson(json_t *root) override {
+		json_t *realtimeUpdate_J = json_object_get(root, "realtimeUpdate");
+		json_t *allowRetrigger_J = json_object_get(root, "allowRetrigger");
+		if(realtimeUpdate_J) {
+			realtimeUpdate = json_boolean_value(realtimeUpdate_J);
+		}
+		if(allowRetrigger_J) {
+			allowRetrigger = json_boolean_value(allowRetrigger_J);
+		}
+	}
+
+};
+
+void PulseGenModule::process(const ProcessArgs &args) {
+	float deltaTime = args.sampleTime;
+	const int channels = inputs[TRIG_INPUT].getChannels();
+
+	// handle duration knob and CV
+	float knob_value = params[GATE_LENGTH_PARAM].getValue();
+	float cv_amt = params[CV_AMT_PARAM].getValue();
+	float cv_voltage = inputs[GATE_LENGTH_INPUT].getVoltage();
+
+	if(params[LIN_LOG_MODE_PARAM].getValue() < 0.5f) {
+		// linear mode
+		cv_scale = cv_amt;
+		gate_base_duration = knob_value;
+	} else {
+		// logarithmic mode
+		float exponent = rescale(knob_value,
+				0.f, 10.f, MIN_EXPONENT, MAX_EXPONENT);
+
+		float cv_exponent = rescale(fabs(cv_amt), 0.f, 1.f,
+				MIN_EXPONENT, MAX_EXPONENT);
+
+		// decrease exponent by one so that 10V maps to 1.0 (100%) CV.
+		cv_scale = powf(10.0f, cv_exponent - 1.f) * signum(cv_amt); // take sign into account
+
+		gate_base_duration = powf(10.0f, exponent);
+	}
+	//TODO: make duration polyphonic? how to display it?
+	gate_duration = clamp(gate_base_duration + cv_voltage * cv_scale, 0.f, 10.f);
+
+	// the conditions that are the same for all channels, as lane masks
+	const float_4 canTrigger = gate_duration > 0.f ? float_4::mask() : float_4::zero();
+	const float_4 canRetrigger = allowRetrigger ? float_4::mask() : float_4::zero();
+
+	for(int c = 0; c < channels; c += 4) {
+		const int i = c / 4;
+
+		// the thresholds are 0.1V and 2V
+		float_4 triggered = inputTrigger[i].process(inputs[TRIG_INPUT].getVoltageSimd<float_4>(c), 0.1f, 2.f);
+
+		gateGenerator[i].trigger(triggered & canTrigger & (gateGenerator[i].finished | canRetrigger), gate_duration);
+
+		// update trigger duration even in the middle of a trigger
+		gateGenerator[i].triggerDuration = gate_duration;
+
+		float_4 gate = gateGenerator[i].process(deltaTime);
+
+		// the pulse just ended
+		finishTriggerGenerator[i].trigger(lastGate[i] & ~gate, 1.e-3f);
+		lastGate[i] = gate;
+
+		float_4 finish = finishTriggerGenerator[i].process(deltaTime);
+		outputs[GATE_OUTPUT].setVoltageSimd(simd::ifelse(gate, 10.f, 0.f), c);
+		outputs[FINISH_OUTPUT].setVoltageSimd(simd::ifelse(finish, 10.f, 0.f), c);
+	}
+
+	outputs[GATE_OUTPUT].setChannels(channels);
+	outputs[FINISH_OUTPUT].setChannels(channels);
+
+	if(channels > 0) {
+		//TODO: fix lights for polyphonic mode...
+		lights[GATE_LIGHT].setSmoothBrightness(outputs[GATE_OUTPUT].getVoltage(channels - 1), deltaTime);
+		lights[FINISH_LIGHT].setSmoothBrightness(outputs[FINISH_OUTPUT].getVoltage(channels - 1), deltaTime);
+	}
+
+}
+
+} // namespace simd4
@@ -0,0 +1,177 @@
+#pragma once
+#include "plugin.hpp"
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <functional>
+
+// A stand-in for Rack's engine, for running modules headless. Like
+// Engine::step(), each engine frame every thread processes its share of the
+// modules and then waits at a barrier for the others. Module k is processed
+// by thread k % numThreads, there is no work stealing.
+//
+// The modules are kept in slots that can be filled and emptied from another
+// thread while the engine runs, which plays the part of the GUI thread. A
+// module taken out of its slot may still be processed during the current
+// engine frame, see waitFrames().
+
+// Sense-reversing barrier. Spins for a while and then yields, so that more
+// threads than cores still make progress.
+struct StandInBarrier {
+	const int total;
+	std::atomic<int> count{0};
+	std::atomic<int> generation{0};
+
+	StandInBarrier(int total) : total(total) {}
+
+	// The last thread to arrive runs onComplete before releasing the others.
+	template <typename F>
+	void wait(F onComplete) {
+		const int gen = generation.load(std::memory_order_acquire);
+		if(count.fetch_add(1, std::memory_order_acq_rel) + 1 == total) {
+			onComplete();
+			count.store(0, std::memory_order_relaxed);
+			generation.store(gen + 1, std::memory_order_release);
+			return;
+		}
+		for(int spins = 0; generation.load(std::memory_order_acquire) == gen; spins++) {
+			if(spins >= 256) {
+				std::this_thread::yield();
+			}
+		}
+	}
+	void wait() {
+		wait([]() {});
+	}
+};
+
+// Latency histogram with buckets 1/16 octave wide, so recording a sample
+// never allocates. Values are in nanoseconds.
+struct StandInHistogram {
+	static const int numBuckets = 64 * 16;
+	uint64_t counts[numBuckets] = {};
+	uint64_t total = 0;
+	uint64_t max = 0;
+
+	static int getBucket(uint64_t ns) {
+		if(ns < 16) {
+			return ns;
+		}
+		const int e = 63 - __builtin_clzll(ns);
+		return (e - 3) * 16 + ((ns >> (e - 4)) & 15);
+	}
+	// The largest value that falls into bucket b.
+	static uint64_t getUpperBound(int b) {
+		if(b < 16) {
+			return b;
+		}
+		const int e = b / 16 + 3;
+		return ((uint64_t) (16 + b % 16 + 1) << (e - 4)) - 1;
+	}
+
+	void add(uint64_t ns) {
+		counts[getBucket(ns)]++;
+		total++;
+		max = std::max(max, ns);
+	}
+	void add(const StandInHistogram &h) {
+		for(int b = 0; b < numBuckets; b++) {
+			counts[b] += h.counts[b];
+		}
+		total += h.total;
+		max = std::max(max, h.max);
+	}
+	// Upper bound of the bucket holding quantile q, within 1/16 octave.
+	uint64_t getQuantile(double q) const {
+		const uint64_t rank = (uint64_t) (q * total);
+		uint64_t seen = 0;
+		for(int b = 0; b < numBuckets; b++) {
+			seen += counts[b];
+			if(seen > rank) {
+				return std::min(getUpperBound(b), max);
+			}
+		}
+		return max;
+	}
+};
+
+inline uint64_t standInNow() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct StandInEngine {
+	const int numThreads;
+	float sampleRate = 44100.f;
+	std::vector<std::atomic<Module*>> slots;
+	std::atomic<int64_t> frame{0};
+	std::atomic<bool> running{false};
+	StandInBarrier barrier;
+
+	// Called by the engine threads for each module in their slots, in place
+	// of module->process(args). Defaults to just that.
+	std::function<void(int thread, int slot, Module *m, const Module::ProcessArgs &args)> processModule;
+	// Called by each engine thread once all modules have been processed
+	// during an engine frame, before the next one starts. Optional.
+	std::function<void(int thread, int64_t frame)> endFrame;
+
+	StandInEngine(int numThreads, int numSlots) : numThreads(numThreads), slots(numSlots), barrier(numThreads) {
+		for(std::atomic<Module*> &slot : slots) {
+			slot.store(NULL);
+		}
+		processModule = [](int thread, int slot, Module *m, const Module::ProcessArgs &args) {
+			m->process(args);
+		};
+	}
+
+	// Process numFrames engine frames on numThreads threads, including the
+	// calling one. Returns once they are all done.
+	void run(int64_t numFrames) {
+		const int64_t end = frame.load() + numFrames;
+		running = true;
+		std::vector<std::thread> threads;
+		for(int t = 1; t < numThreads; t++) {
+			threads.push_back(std::thread([this, t, end]() { runThread(t, end); }));
+		}
+		runThread(0, end);
+		for(std::thread &thread : threads) {
+			thread.join();
+		}
+		running = false;
+	}
+
+	void runThread(int t, int64_t end) {
+		Module::ProcessArgs args;
+		args.sampleRate = sampleRate;
+		args.sampleTime = 1.f / sampleRate;
+		for(;;) {
+			const int64_t f = frame.load(std::memory_order_acquire);
+			if(f >= end) {
+				break;
+			}
+			args.frame = f;
+			for(int k = t; k < (int) slots.size(); k += numThreads) {
+				Module *m = slots[k].load(std::memory_order_acquire);
+				if(m) {
+					processModule(t, k, m, args);
+				}
+			}
+			if(endFrame) {
+				barrier.wait();
+				endFrame(t, f);
+			}
+			barrier.wait([this]() { frame.fetch_add(1, std::memory_order_release); });
+		}
+	}
+
+	// Block until n more engine frames have started, e.g. before deleting a
+	// module that was just taken out of its slot. Returns at once if the
+	// engine isn't running.
+	void waitFrames(int64_t n) {
+		const int64_t target = frame.load() + n;
+		while(running && frame.load() < target) {
+			std::this_thread::sleep_for(std::chrono::microseconds(50));
+		}
+	}
+};
@@ -0,0 +1,170 @@
+// Benchmark of many outputs reading one Teleport source, on 1 to 32 threads of
+// a stand-in engine. Prints the wall time per engine frame of each way of
+// reading:
+//   inputs       straight from the Input ports of the source, as live outputs
+//                did before TeleportFrame
+//   frame        from the TeleportFrame of the source, as live outputs do now
+//   out live     Teleport Out modules, live
+//   out determ.  Teleport Out modules, deterministic
+// The source has 16 ports of 16 channels, and each output reads all of them.
+// With more threads than cores the threads mostly wait for each other, so only
+// compare the rows up to the number of cores.
+//
+//   teleport-scaling [frames [outputs]]
+
+#include "../src/Teleport.cpp"
+#include "StandInEngine.hpp"
+
+Plugin *pluginInstance = NULL;
+
+static const int sourcePorts = 16;
+
+// Reads the source the way processLive() did before the source had a frame.
+struct InputsReader : Module {
+	TeleportInModule *src;
+
+	InputsReader(TeleportInModule *src) : src(src) {
+		config(0, 0, sourcePorts);
+	}
+
+	void process(const ProcessArgs &args) override {
+		for(int i = 0; i < sourcePorts; i++) {
+			Input &input = src->inputs[TeleportInModule::INPUT_1 + i];
+			Output &output = outputs[i];
+			const int channels = input.getChannels();
+			output.setChannels(channels);
+			copyVoltages(output.getVoltages(), input.getVoltages(), channels);
+		}
+	}
+};
+
+// The same from the frame of the source, like processLive() does now.
+struct FrameReader : Module {
+	TeleportInModule *src;
+
+	FrameReader(TeleportInModule *src) : src(src) {
+		config(0, 0, sourcePorts);
+	}
+
+	void process(const ProcessArgs &args) override {
+		for(int i = 0; i < sourcePorts; i++) {
+			Output &output = outputs[i];
+			const int channels = src->liveFrame->channels[i];
+			output.setChannels(channels);
+			copyVoltages(output.getVoltages(), src->liveFrame->voltages[i], channels);
+		}
+	}
+};
+
+enum ReadMode {
+	READ_INPUTS,
+	READ_FRAME,
+	READ_OUT_LIVE,
+	READ_OUT_DETERMINISTIC,
+	NUM_READ_MODES
+};
+static const char *readModeNames[NUM_READ_MODES] = {"inputs", "frame", "out live", "out determ."};
+
+// As if a cable was connected, unconnected outputs ignore setChannels().
+static void connectOutputs(Module *m) {
+	for(Output &output : m->outputs) {
+		output.channels = 1;
+	}
+}
+
+static Module* createReader(ReadMode mode, TeleportInModule *src) {
+	Module *m;
+	if(mode == READ_INPUTS) {
+		m = new InputsReader(src);
+	} else if(mode == READ_FRAME) {
+		m = new FrameReader(src);
+	} else {
+		TeleportOutModule *out = new TeleportOutModule();
+		out->setNumPorts(sourcePorts);
+		out->deterministic = mode == READ_OUT_DETERMINISTIC;
+		out->setLabel(src->label);
+		m = out;
+	}
+	connectOutputs(m);
+	return m;
+}
+
+// Stand-in for the cables into the source.
+static void setInputs(TeleportInModule *src, int64_t frame) {
+	for(int i = 0; i < sourcePorts; i++) {
+		Input &input = src->inputs[TeleportInModule::INPUT_1 + i];
+		input.channels = MAX_POLY_CHANNELS;
+		for(int c = 0; c < MAX_POLY_CHANNELS; c++) {
+			input.voltages[c] = (float) (frame % 1000) + c;
+		}
+	}
+}
+
+static StandInEngine *currentEngine = NULL;
+
+// Wall time of one engine frame in nanoseconds, with the source in the
+// first slot and the readers after it.
+static double measure(int numThreads, int64_t numFrames, TeleportInModule *src, const std::vector<Module*> &readers) {
+	StandInEngine engine(numThreads, 1 + readers.size());
+	engine.slots[0].store(src);
+	for(size_t k = 0; k < readers.size(); k++) {
+		engine.slots[1 + k].store(readers[k]);
+	}
+	engine.processModule = [src](int t, int k, Module *m, const Module::ProcessArgs &args) {
+		if(m == src) {
+			setInputs(src, args.frame);
+		}
+		m->process(args);
+	};
+	currentEngine = &engine;
+	engine.run(numFrames / 10 + 1); // warm up
+	const uint64_t start = standInNow();
+	engine.run(numFrames);
+	const uint64_t ns = standInNow() - start;
+	currentEngine = NULL;
+	return (double) ns / numFrames;
+}
+
+int main(int argc, char **argv) {
+	const int64_t numFrames = argc > 1 ? std::max(atoll(argv[1]), 1LL) : 50000;
+	const int numReaders = argc > 2 ? std::max(atoi(argv[2]), 1) : 64;
+	contextSet(new Context());
+	random::init();
+	Teleport::getEngineFrame = []() -> int64_t {
+		return currentEngine ? currentEngine->frame.load() : -1;
+	};
+
+	TeleportInModule *src = new TeleportInModule();
+	src->setNumPorts(sourcePorts);
+	src->updateLabel("SCAL");
+	std::vector<Module*> readers[NUM_READ_MODES];
+	for(int mode = 0; mode < NUM_READ_MODES; mode++) {
+		for(int k = 0; k < numReaders; k++) {
+			readers[mode].push_back(createReader((ReadMode) mode, src));
+		}
+	}
+
+	printf("%lld frames, %d outputs reading %d ports of %d channels, %u cores\n",
+		(long long) numFrames, numReaders, sourcePorts, MAX_POLY_CHANNELS, std::thread::hardware_concurrency());
+	printf("ns per frame\n%-8s", "threads");
+	for(int mode = 0; mode < NUM_READ_MODES; mode++) {
+		printf(" %12s", readModeNames[mode]);
+	}
+	printf("\n");
+	for(int numThreads = 1; numThreads <= 32; numThreads *= 2) {
+		printf("%-8d", numThreads);
+		for(int mode = 0; mode < NUM_READ_MODES; mode++) {
+			printf(" %12.0f", measure(numThreads, numFrames, src, readers[mode]));
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+
+	for(int mode = 0; mode < NUM_READ_MODES; mode++) {
+		for(Module *m : readers[mode]) {
+			delete m;
+		}
+	}
+	delete src;
+	return 0;
+}
@@ -0,0 +1,466 @@
+// Stress test for the teleport registry. Teleport Ins and Outs run on several
+// threads of a stand-in engine while another thread, playing the GUI, keeps
+// renaming, duplicating and deleting the inputs and retargeting the outputs.
+// Reports the process() latency of both, and any torn or invalid reads.
+// Exits with 1 if there was a read that the mode of its output rules out, or
+// if the round trip through TeleportApi.hpp failed.
+//
+//   teleport-stress [threads [frames [microseconds between GUI changes]]]
+//
+// Also meant to be run built with TSAN=1, see tsan.supp for the races that
+// are there by design.
+
+#include "../src/Teleport.cpp"
+#include "StandInEngine.hpp"
+#include <condition_variable>
+
+Plugin *pluginInstance = NULL;
+
+// Every port of every input carries patternChannels channels of the same
+// value, which encodes the engine frame the input was set in. An output with
+// channels that differ was torn, one with a frame that its mode doesn't
+// allow read the wrong slot or the wrong source.
+static const int patternChannels = 8;
+static const int64_t patternPeriod = 1 << 20; // frames, so that the values stay exact in a float
+static const int maxInputPorts = 16; // the GUI changes the inputs between 4 and this many ports
+static const int outputPorts = 8;
+static const int numBuses = 4;
+
+static float encodeFrame(int64_t frame) {
+	return (float) (frame % patternPeriod + 1);
+}
+
+// Number of frames from the one encoded in v to frame, -1 if v isn't an
+// encoded frame.
+static int64_t getAge(float v, int64_t frame) {
+	if(v < 1.f || v > (float) patternPeriod || v != std::floor(v)) {
+		return -1;
+	}
+	return ((frame - ((int64_t) v - 1)) % patternPeriod + patternPeriod) % patternPeriod;
+}
+
+enum OutKind {
+	OUT_LIVE, // current or previous frame, may be torn by design with several threads
+	OUT_DETERMINISTIC, // exactly the previous frame
+	OUT_DELAYED, // delays keep changing, but never the frame being written
+	OUT_MIXED, // deterministic, switching between matrix, bus return and normal mode
+	NUM_OUT_KINDS
+};
+static const char *outKindNames[NUM_OUT_KINDS] = {"live", "deterministic", "delayed", "mixed"};
+
+struct ThreadResults {
+	StandInHistogram inLatency;
+	StandInHistogram outLatency;
+	uint64_t reads = 0;
+	uint64_t emptyReads = 0; // silent ports, e.g. stale reads or missing sources
+	uint64_t tornReads[NUM_OUT_KINDS] = {};
+	uint64_t invalidReads[NUM_OUT_KINDS] = {};
+};
+
+// Stand-in for the engine lock Rack holds while adding and removing modules:
+// the GUI thread queues a function, and the last engine thread to finish a
+// frame runs it before the next one starts.
+struct ExclusiveQueue {
+	std::mutex mutex;
+	std::condition_variable done;
+	std::vector<std::function<void()>> pending;
+	std::atomic<bool> hasPending{false};
+
+	// Engine side, called while no module is being processed.
+	void runPending() {
+		if(!hasPending.load(std::memory_order_acquire)) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(mutex);
+		for(std::function<void()> &f : pending) {
+			f();
+		}
+		pending.clear();
+		hasPending = false;
+		done.notify_all();
+	}
+
+	// GUI side, returns once f has run.
+	void run(StandInEngine &engine, std::function<void()> f) {
+		std::unique_lock<std::mutex> lock(mutex);
+		if(!engine.running) {
+			f();
+			return;
+		}
+		pending.push_back(f);
+		hasPending = true;
+		// the engine may stop before getting to it
+		while(hasPending && engine.running) {
+			done.wait_for(lock, std::chrono::milliseconds(1));
+		}
+		if(hasPending) {
+			for(std::function<void()> &g : pending) {
+				g();
+			}
+			pending.clear();
+			hasPending = false;
+		}
+	}
+};
+
+struct Stress {
+	int numThreads;
+	int64_t numFrames;
+	int churnInterval; // microseconds
+	int numIns = 24;
+	int maxIns = 32;
+	int numOuts = 64;
+
+	StandInEngine engine;
+	ExclusiveQueue exclusive;
+	std::vector<ThreadResults> results;
+	std::vector<std::string> labels; // the inputs are renamed among these
+	std::vector<std::string> buses;
+	StandInHistogram guiLatency;
+	uint64_t guiChanges = 0;
+	int64_t nextModuleId = 0;
+
+	Stress(int numThreads, int64_t numFrames, int churnInterval) :
+		numThreads(numThreads), numFrames(numFrames), churnInterval(churnInterval),
+		engine(numThreads, maxIns + numOuts), results(numThreads) {
+		for(int i = 0; i < 2 * maxIns; i++) {
+			labels.push_back(string::f("L%02d", i));
+		}
+		for(int i = 0; i < numBuses; i++) {
+			buses.push_back(string::f("BUS%d", i));
+		}
+	}
+
+	TeleportInModule* getIn(int k) {
+		return (TeleportInModule*) engine.slots[k].load();
+	}
+	TeleportOutModule* getOut(int k) {
+		return (TeleportOutModule*) engine.slots[maxIns + k].load();
+	}
+	static OutKind getKind(int k) {
+		return (OutKind) (k % NUM_OUT_KINDS);
+	}
+
+	void setUp() {
+		for(int k = 0; k < numIns; k++) {
+			TeleportInModule *in = new TeleportInModule();
+			in->id = nextModuleId++;
+			in->updateLabel(labels[k]);
+			in->setSendBus(buses[k % numBuses]);
+			engine.slots[k].store(in);
+		}
+		for(int k = 0; k < numOuts; k++) {
+			TeleportOutModule *out = new TeleportOutModule();
+			out->id = nextModuleId++;
+			out->setNumPorts(outputPorts);
+			for(int i = 0; i < outputPorts; i++) {
+				// as if a cable was connected, unconnected outputs ignore setChannels()
+				out->outputs[TeleportOutModule::OUTPUT_1 + i].channels = 1;
+			}
+			const OutKind kind = getKind(k);
+			out->deterministic = kind == OUT_DETERMINISTIC || kind == OUT_MIXED;
+			out->setLabel(labels[k % numIns]);
+			if(kind == OUT_DELAYED) {
+				for(int i = 0; i < outputPorts; i++) {
+					out->setDelay(i, 1 + i);
+				}
+			}
+			engine.slots[maxIns + k].store(out);
+		}
+
+		engine.processModule = [this](int t, int k, Module *m, const Module::ProcessArgs &args) {
+			if(k < maxIns) {
+				setPattern((TeleportInModule*) m, args.frame);
+			}
+			const uint64_t start = standInNow();
+			m->process(args);
+			const uint64_t ns = standInNow() - start;
+			if(k < maxIns) {
+				results[t].inLatency.add(ns);
+			} else {
+				results[t].outLatency.add(ns);
+			}
+		};
+		engine.endFrame = [this](int t, int64_t frame) {
+			for(int k = t; k < (int) engine.slots.size(); k += numThreads) {
+				if(k >= maxIns) {
+					check(results[t], getOut(k - maxIns), getKind(k - maxIns), frame);
+				}
+			}
+			if(t == 0) {
+				exclusive.runPending();
+			}
+		};
+		// Retired objects are freed two frames later, as with Rack's engine.
+		Teleport::getEngineFrame = [this]() -> int64_t {
+			return engine.running ? engine.frame.load() : -1;
+		};
+	}
+
+	// Stand-in for the cables into an input.
+	static void setPattern(TeleportInModule *in, int64_t frame) {
+		const float v = encodeFrame(frame);
+		const int numPorts = in->numPorts.load(std::memory_order_relaxed);
+		for(int i = 0; i < maxInputPorts; i++) {
+			Input &input = in->inputs[TeleportInModule::INPUT_1 + i];
+			input.channels = i < numPorts ? patternChannels : 0;
+			for(int c = 0; c < patternChannels; c++) {
+				input.voltages[c] = v;
+			}
+		}
+	}
+
+	// Called after all modules have been processed during frame.
+	static void check(ThreadResults &r, TeleportOutModule *out, OutKind kind, int64_t frame) {
+		for(int i = 0; i < outputPorts; i++) {
+			Output &output = out->outputs[TeleportOutModule::OUTPUT_1 + i];
+			const int channels = output.getChannels();
+			const float v = output.getVoltage(0);
+			r.reads++;
+			bool torn = false;
+			for(int c = 1; c < channels; c++) {
+				torn = torn || output.getVoltage(c) != v;
+			}
+			if(torn) {
+				r.tornReads[kind]++;
+				continue;
+			}
+			if(v == 0.f) {
+				r.emptyReads++;
+				continue;
+			}
+			if(kind == OUT_MIXED) {
+				// crossfades and sums aren't encoded frames
+				continue;
+			}
+			const int64_t age = getAge(v, frame);
+			bool valid = channels == patternChannels;
+			if(kind == OUT_LIVE) {
+				valid = valid && (age == 0 || age == 1);
+			} else if(kind == OUT_DETERMINISTIC) {
+				valid = valid && age == 1;
+			} else {
+				valid = valid && age >= 1 && age <= TELEPORT_MAX_DELAY;
+			}
+			if(!valid) {
+				r.invalidReads[kind]++;
+			}
+		}
+	}
+
+	// The GUI thread.
+	void churn() {
+		random::init();
+		while(engine.running) {
+			const uint64_t start = standInNow();
+			if(change()) {
+				guiLatency.add(standInNow() - start);
+				guiChanges++;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(churnInterval));
+		}
+	}
+
+	int randomInt(int n) {
+		return random::u32() % n;
+	}
+
+	// A random in slot that is (or isn't) in use, -1 if there's none.
+	int findIn(bool used) {
+		const int start = randomInt(maxIns);
+		for(int i = 0; i < maxIns; i++) {
+			const int k = (start + i) % maxIns;
+			if((getIn(k) != NULL) == used) {
+				return k;
+			}
+		}
+		return -1;
+	}
+
+	// Make one random change. Returns whether its latency should be
+	// counted, i.e. it didn't wait for the engine.
+	bool change() {
+		const int outIndex = randomInt(numOuts);
+		TeleportOutModule *out = getOut(outIndex);
+		const OutKind kind = getKind(outIndex);
+		const int inSlot = findIn(true);
+		TeleportInModule *in = inSlot >= 0 ? getIn(inSlot) : NULL;
+		// mostly an existing source, sometimes one that doesn't exist (yet)
+		const std::string label = (in && randomInt(4) > 0) ? in->label : labels[randomInt(labels.size())];
+
+		// Outputs are retargeted more often than the rest, to keep most of
+		// them connected to a source.
+		int op = randomInt(20);
+		if(op >= 9) {
+			op = 1;
+		}
+		switch(op) {
+			case 0: {
+				if(in) {
+					// fails if the label is taken, which is fine too
+					in->updateLabel(labels[randomInt(labels.size())]);
+				}
+			} break;
+			case 1: {
+				if(!out->busReturn) {
+					out->setLabel(label);
+				}
+			} break;
+			case 2: {
+				if(in) {
+					in->setNumPorts(4 + randomInt(maxInputPorts - 3));
+				}
+			} break;
+			case 3: {
+				if(kind == OUT_DELAYED) {
+					out->setDelay(randomInt(outputPorts), 1 + randomInt(4000));
+				}
+			} break;
+			case 4: {
+				if(in) {
+					in->setSendBus(randomInt(numBuses + 1) == 0 ? "" : buses[randomInt(numBuses)]);
+				}
+			} break;
+			case 5: {
+				if(kind == OUT_MIXED) {
+					// same as the context menu of Teleport Out
+					const int mode = randomInt(3);
+					out->matrix = mode == 1;
+					out->busReturn = mode == 2;
+					out->setLabel(mode == 2 ? buses[randomInt(numBuses)] : label);
+				}
+			} break;
+			case 6: {
+				if(kind == OUT_MIXED) {
+					out->setRoute(randomInt(outputPorts), label, randomInt(maxInputPorts));
+				}
+			} break;
+			case 7: {
+				duplicateIn(in);
+			} return false;
+			case 8: {
+				removeIn(inSlot);
+			} return false;
+		}
+		return true;
+	}
+
+	// Like duplicating a module in Rack, which gives the copy a new label.
+	void duplicateIn(TeleportInModule *in) {
+		const int k = findIn(false);
+		if(!in || k < 0) {
+			return;
+		}
+		TeleportInModule *copy = new TeleportInModule();
+		copy->id = nextModuleId++;
+		json_t *data = in->dataToJson();
+		copy->dataFromJson(data);
+		json_decref(data);
+		Teleport::endPaste();
+		exclusive.run(engine, [this, k, copy]() {
+			engine.slots[k].store(copy);
+			Module::AddEvent e;
+			copy->onAdd(e);
+		});
+	}
+
+	// Like deleting a module in Rack.
+	void removeIn(int k) {
+		int used = 0;
+		for(int i = 0; i < maxIns; i++) {
+			used += getIn(i) != NULL;
+		}
+		if(k < 0 || used <= numIns / 2) {
+			return;
+		}
+		TeleportInModule *in = getIn(k);
+		exclusive.run(engine, [this, k, in]() {
+			engine.slots[k].store(NULL);
+			Module::RemoveEvent e;
+			in->onRemove(e);
+		});
+		delete in;
+	}
+
+	int run() {
+		setUp();
+		const bool apiOk = checkApi();
+
+		engine.running = true;
+		std::thread gui([this]() {
+			contextSet(new Context());
+			churn();
+		});
+		engine.run(numFrames);
+		gui.join();
+
+		ThreadResults total;
+		for(ThreadResults &r : results) {
+			total.inLatency.add(r.inLatency);
+			total.outLatency.add(r.outLatency);
+			total.reads += r.reads;
+			total.emptyReads += r.emptyReads;
+			for(int k = 0; k < NUM_OUT_KINDS; k++) {
+				total.tornReads[k] += r.tornReads[k];
+				total.invalidReads[k] += r.invalidReads[k];
+			}
+		}
+		printf("%d threads, %lld frames, %d inputs, %d outputs, %llu GUI changes\n",
+			numThreads, (long long) numFrames, numIns, numOuts, (unsigned long long) guiChanges);
+		printLatency("Teleport In process()", total.inLatency);
+		printLatency("Teleport Out process()", total.outLatency);
+		printLatency("GUI changes", guiLatency);
+		printf("reads: %llu, silent: %llu\n", (unsigned long long) total.reads, (unsigned long long) total.emptyReads);
+
+		// Live outputs read the inputs while they're being written, unless
+		// everything runs on one thread.
+		bool failed = !apiOk;
+		for(int k = 0; k < NUM_OUT_KINDS; k++) {
+			const bool allowed = k == OUT_LIVE && numThreads > 1;
+			printf("%-14s torn: %llu, invalid: %llu%s\n", outKindNames[k],
+				(unsigned long long) total.tornReads[k], (unsigned long long) total.invalidReads[k],
+				allowed ? " (allowed with several threads)" : "");
+			failed = failed || (!allowed && (total.tornReads[k] > 0 || total.invalidReads[k] > 0));
+		}
+		printf("API round trip: %s\n", apiOk ? "ok" : "FAILED");
+		printf("%s\n", failed ? "FAILED" : "ok");
+		return failed ? 1 : 0;
+	}
+
+	static void printLatency(const char *name, const StandInHistogram &h) {
+		printf("%-24s p50 %6llu ns, p99 %6llu ns, max %8llu ns\n", name,
+			(unsigned long long) h.getQuantile(0.5), (unsigned long long) h.getQuantile(0.99), (unsigned long long) h.max);
+	}
+
+	// Publish through the API and read it back, before the engine starts.
+	static bool checkApi() {
+		const LittleUtilsTeleportApi *api = littleUtilsGetTeleportApi();
+		LittleUtilsTeleportSource *source = api->createSource("API", 2);
+		if(!source) {
+			return false;
+		}
+		LittleUtilsTeleportReader *reader = api->openReader("API");
+		const float in[3] = {1.f, 2.f, 3.f};
+		float out[MAX_POLY_CHANNELS] = {};
+		api->setPort(source, 1, in, 3);
+		api->publish(source, 100);
+		bool ok = api->sourceExists("API") && api->getNumPorts(reader) == 2;
+		ok = ok && api->read(reader, 101, 1, out) == 3 && out[0] == 1.f && out[1] == 2.f && out[2] == 3.f;
+		// only the frame after the one published can be read
+		ok = ok && api->read(reader, 102, 1, out) == -1;
+		api->destroySource(source);
+		ok = ok && !api->sourceExists("API") && api->getNumPorts(reader) == 0;
+		api->closeReader(reader);
+		return ok;
+	}
+};
+
+int main(int argc, char **argv) {
+	const int numThreads = argc > 1 ? std::max(atoi(argv[1]), 1) : 4;
+	const int64_t numFrames = argc > 2 ? std::max(atoll(argv[2]), 1LL) : 200000;
+	const int churnInterval = argc > 3 ? std::max(atoi(argv[3]), 0) : 1000;
+	contextSet(new Context());
+	random::init();
+	Stress stress(numThreads, numFrames, churnInterval);
+	return stress.run();
+}
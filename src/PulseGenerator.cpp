@@ -4,38 +4,48 @@
 
 #include <algorithm> // std::replace
 
+using simd::float_4;
+
 //TODO: when cv has been recently adjusted, tweaking the main knob should switch the display to the non-cv view.
 
 const float MIN_EXPONENT = -3.0f;
 const float MAX_EXPONENT = 1.0f;
-
-// based on PulseGeneraotr in include/util/digital.hpp
+const float LOG2_10 = 3.32192809f;
+
+// based on PulseGeneraotr in include/util/digital.hpp, but processes four
+// channels at a time and counts samples instead of summing up sampleTime,
+// which drifts for long pulses. Each lane of the vectors is one channel, and
+// the flags are lane masks. The counts are whole numbers, which a float holds
+// exactly up to 2^24 samples, far more than 10s at 192kHz. The length of a
+// pulse is only computed when it starts or its duration changes.
 struct CustomPulseGenerator {
-	float time;
-	float triggerDuration;
-	bool finished; // the output is the inverse of this
-
-	CustomPulseGenerator() {
-		reset();
+	float_4 elapsed = 0.f; // samples since the pulse started
+	float_4 length = 0.f; // samples the pulse lasts, at least one
+	float_4 duration = 0.f; // the duration that length was computed from
+	float_4 active = float_4::zero(); // lanes with a pulse going on
+
+	/** Begins a pulse on the lanes set in `mask`, retriggering even with a shorter duration. */
+	void trigger(float_4 mask) {
+		elapsed = simd::ifelse(mask, 0.f, elapsed);
+		active |= mask;
 	}
-	/** Immediately resets the state to LOW */
-	void reset() {
-		time = 0.f;
-		triggerDuration = 0.f;
-		finished = true;
-	}
-	/** Advances the state by `deltaTime`. Returns whether the pulse is in the HIGH state. */
-	bool process(float deltaTime) {
-		time += deltaTime;
-		if(!finished) finished = time >= triggerDuration;
-		return !finished;
+	/** Changes the duration of the lanes set in `mask`, even in the middle of a pulse. */
+	void setDuration(float_4 mask, float_4 duration, float sampleRate) {
+		// 10s at 192kHz is far from the precision limit of a double, which
+		// keeps the rounding the same for every sample rate
+		for(int m = simd::movemask(mask), l = 0; m; m >>= 1, l++) {
+			if(m & 1) {
+				this->duration[l] = duration[l];
+				length[l] = std::max(1.0, std::round((double) duration[l] * sampleRate));
+			}
+		}
 	}
-	/** Begins a trigger with the given `triggerDuration`. */
-	void trigger(float triggerDuration) {
-		// retrigger even with a shorter duration
-		time = 0.f;
-		finished = false;
-		this->triggerDuration = triggerDuration;
+	/** Advances the lanes with a pulse by one sample. Returns a mask of the lanes in the HIGH state. */
+	float_4 process() {
+		const float_4 high = active & (elapsed < length);
+		active = high;
+		elapsed += simd::ifelse(high, 1.f, 0.f);
+		return high;
 	}
 };
 
@@ -64,11 +74,14 @@ struct PulseGenModule : Module {
 		NUM_LIGHTS
 	};
 
-	// not using SIMD here, doesn't seem to affect performance much
-	dsp::SchmittTrigger inputTrigger[MAX_POLY_CHANNELS], finishTrigger[MAX_POLY_CHANNELS];
-	CustomPulseGenerator gateGenerator[MAX_POLY_CHANNELS], finishTriggerGenerator[MAX_POLY_CHANNELS];
+	// four channels at a time, element i holds channels 4i..4i+3. Groups of
+	// four channels without a pulse going on are skipped, their outputs stay
+	// at 0V.
+	dsp::TSchmittTrigger<float_4> inputTrigger[MAX_POLY_CHANNELS / 4];
+	CustomPulseGenerator gateGenerator[MAX_POLY_CHANNELS / 4], finishTriggerGenerator[MAX_POLY_CHANNELS / 4];
+	float sampleRate = 0.f; // the sample rate that the ends of the pulses were computed with
 	float gate_base_duration = 0.5f; // gate duration without CV
-	float gate_duration;
+	float gate_duration; // gate duration of the first channel, including CV
 	bool realtimeUpdate = true; // whether to display gate_duration or gate_base_duration
 	float cv_scale = 0.f; // cv_scale = +- 1 -> 10V CV changes duration by +-10s
 	bool allowRetrigger = true; // whether to allow the pulse to be retriggered if it is already outputting
@@ -95,6 +108,14 @@ struct PulseGenModule : Module {
 
 	void process(const ProcessArgs &args) override;
 
+	float getDuration(int c) {
+		// monophonic CV applies to all channels
+		return clamp(gate_base_duration + inputs[GATE_LENGTH_INPUT].getPolyVoltage(c) * cv_scale, 0.f, 10.f);
+	}
+	float_4 getDurationSimd(int c) {
+		return simd::clamp(gate_base_duration + inputs[GATE_LENGTH_INPUT].getPolyVoltageSimd<float_4>(c) * cv_scale, 0.f, 10.f);
+	}
+
 	json_t *dataToJson() override {
 		json_t *root = json_object();
 		json_object_set_new(root, "realtimeUpdate", json_boolean(realtimeUpdate));
@@ -122,7 +143,6 @@ void PulseGenModule::process(const ProcessArgs &args) {
 	// handle duration knob and CV
 	float knob_value = params[GATE_LENGTH_PARAM].getValue();
 	float cv_amt = params[CV_AMT_PARAM].getValue();
-	float cv_voltage = inputs[GATE_LENGTH_INPUT].getVoltage();
 
 	if(params[LIN_LOG_MODE_PARAM].getValue() < 0.5f) {
 		// linear mode
@@ -136,48 +156,75 @@ void PulseGenModule::process(const ProcessArgs &args) {
 		float cv_exponent = rescale(fabs(cv_amt), 0.f, 1.f,
 				MIN_EXPONENT, MAX_EXPONENT);
 
+		// Both powers of ten at once, as 10^x = 2^(x log2(10)). The
+		// approximation only holds for positive powers of two, so shift them
+		// up by 2^16 and back down. The relative error is below 1e-5 over the
+		// whole knob and CV range (see bench/PulseGenDurationCheck.cpp), far
+		// less than what the display shows.
 		// decrease exponent by one so that 10V maps to 1.0 (100%) CV.
-		cv_scale = powf(10.0f, cv_exponent - 1.f) * signum(cv_amt); // take sign into account
+		float_4 powers = dsp::approxExp2_taylor5(float_4(exponent, cv_exponent - 1.f, 0.f, 0.f) * LOG2_10 + 16.f) * (1.f / 65536.f);
 
-		gate_base_duration = powf(10.0f, exponent);
+		gate_base_duration = powers[0];
+		cv_scale = powers[1] * signum(cv_amt); // take sign into account
 	}
-	//TODO: make duration polyphonic? how to display it?
-	gate_duration = clamp(gate_base_duration + cv_voltage * cv_scale, 0.f, 10.f);
-
-	for(int c = 0; c < channels; c++) {
-
-		bool triggered = inputTrigger[c].process(rescale(inputs[TRIG_INPUT].getVoltage(c),
-					0.1f, 2.f, 0.f, 1.f));
-
-		if(triggered && gate_duration > 0.f) {
-			if(gateGenerator[c].finished || allowRetrigger) {
-				gateGenerator[c].trigger(gate_duration);
-			}
+	// the duration of each channel is linear in its CV, so polyphonic CV
+	// costs no more powers of ten
+	gate_duration = getDuration(0);
+
+	const bool rateChanged = args.sampleRate != sampleRate;
+	sampleRate = args.sampleRate;
+
+	// the conditions that are the same for all channels, as lane masks
+	const float_4 canRetrigger = allowRetrigger ? float_4::mask() : float_4::zero();
+	const float_4 allLanes = rateChanged ? float_4::mask() : float_4::zero();
+
+	for(int c = 0; c < MAX_POLY_CHANNELS; c += 4) {
+		const int i = c / 4;
+		CustomPulseGenerator &gate = gateGenerator[i];
+		CustomPulseGenerator &finish = finishTriggerGenerator[i];
+		const float_4 inUse = float_4(0.f, 1.f, 2.f, 3.f) + (float) c < (float) channels;
+
+		// the thresholds are 0.1V and 2V
+		float_4 triggered = float_4::zero();
+		if(c < channels) {
+			triggered = inputTrigger[i].process(inputs[TRIG_INPUT].getVoltageSimd<float_4>(c), 0.1f, 2.f) & inUse;
+		}
+		if(!simd::movemask(triggered | gate.active | finish.active)) {
+			continue;
 		}
 
-		// update trigger duration even in the middle of a trigger
-		gateGenerator[c].triggerDuration = gate_duration;
-
-		bool gate = gateGenerator[c].process(deltaTime);
+		// stop the pulses on channels that are gone
+		gate.active &= inUse;
+		finish.active &= inUse;
 
-		if(finishTrigger[c].process(gate ? 0.f : 1.f)) {
-			finishTriggerGenerator[c].trigger(1.e-3f);
-		}
+		const float_4 duration = getDurationSimd(c);
+		triggered &= (duration > 0.f) & (~gate.active | canRetrigger);
+		gate.trigger(triggered);
+		// update the duration even in the middle of a pulse
+		gate.setDuration(gate.active & ((duration != gate.duration) | triggered | allLanes), duration, sampleRate);
 
-		float gate_v = gate ? 10.0f : 0.0f;
-		float finish_v = finishTriggerGenerator[c].process(deltaTime) ? 10.f : 0.f;
-		outputs[GATE_OUTPUT].setVoltage(gate_v, c);
-		outputs[FINISH_OUTPUT].setVoltage(finish_v, c);
+		const float_4 wasHigh = gate.active;
+		const float_4 high = gate.process();
 
-		//TODO: fix lights for polyphonic mode...
-		lights[GATE_LIGHT].setSmoothBrightness(gate_v, deltaTime);
-		lights[FINISH_LIGHT].setSmoothBrightness(finish_v, deltaTime);
+		// the pulse just ended
+		const float_4 ended = wasHigh & ~high;
+		finish.trigger(ended);
+		finish.setDuration(ended | (finish.active & allLanes), 1.e-3f, sampleRate);
+		const float_4 finishHigh = finish.process();
 
+		outputs[GATE_OUTPUT].setVoltageSimd(simd::ifelse(high, 10.f, 0.f), c);
+		outputs[FINISH_OUTPUT].setVoltageSimd(simd::ifelse(finishHigh, 10.f, 0.f), c);
 	}
 
 	outputs[GATE_OUTPUT].setChannels(channels);
 	outputs[FINISH_OUTPUT].setChannels(channels);
 
+	if(channels > 0) {
+		//TODO: fix lights for polyphonic mode...
+		lights[GATE_LIGHT].setSmoothBrightness(outputs[GATE_OUTPUT].getVoltage(channels - 1), deltaTime);
+		lights[FINISH_LIGHT].setSmoothBrightness(outputs[FINISH_OUTPUT].getVoltage(channels - 1), deltaTime);
+	}
+
 }
 
 // TextBox defined in ./Widgets.hpp
@@ -1,7 +1,108 @@
 #include "Teleport.hpp"
+#include "TeleportShm.hpp"
+#include "TeleportRecorder.hpp"
+#include "TeleportApi.hpp"
+#include <osdialog.h>
+#include <set>
 #include "Widgets.hpp"
 #include "Util.hpp"
 
+std::atomic<const TeleportSnapshot*> Teleport::snapshot(new TeleportSnapshot());
+std::atomic<unsigned int> Teleport::sourcesVersion(0);
+std::mutex Teleport::writeMutex;
+std::string Teleport::lastInsertedKey = "";
+std::map<std::string, int> Teleport::labelIds = {};
+std::vector<std::string> Teleport::labelsById = {};
+std::vector<int> Teleport::labelRefs = {};
+std::vector<int> Teleport::freeLabelIds = {};
+std::vector<std::pair<std::function<void()>, int64_t>> Teleport::retired = {};
+std::function<int64_t()> Teleport::getEngineFrame = []() -> int64_t {
+	return (APP && APP->engine) ? APP->engine->getFrame() : -1;
+};
+TeleportLabelAllocator Teleport::labelAllocator;
+bool Teleport::batching = false;
+bool Teleport::pasting = false;
+TeleportSnapshot *Teleport::draft = NULL;
+std::map<std::string, std::string> Teleport::pasteRenames = {};
+std::vector<TeleportOutModule*> Teleport::pastedOutputs = {};
+
+const std::string TeleportLabelAllocator::charset =
+	"0123456789"
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+	"abcdefghijklmnopqrstuvwxyz";
+
+int64_t TeleportLabelAllocator::getSpaceSize() {
+	int64_t size = 1;
+	for(int i = 0; i < length; i++) {
+		size *= charset.size();
+	}
+	return size;
+}
+
+int64_t TeleportLabelAllocator::getIndex(const std::string &lbl) {
+	if((int) lbl.size() != length) {
+		return -1;
+	}
+	int64_t index = 0;
+	for(char c : lbl) {
+		size_t digit = charset.find(c);
+		if(digit == std::string::npos) {
+			return -1;
+		}
+		index = index * charset.size() + digit;
+	}
+	return index;
+}
+
+std::string TeleportLabelAllocator::getLabel(int64_t index) {
+	std::string lbl(length, charset[0]);
+	for(int i = length - 1; i >= 0; i--) {
+		lbl[i] = charset[index % charset.size()];
+		index /= charset.size();
+	}
+	return lbl;
+}
+
+void TeleportLabelAllocator::setTaken(const std::string &lbl, bool isTaken) {
+	int64_t index = getIndex(lbl);
+	if(index < 0) {
+		return;
+	}
+	if(taken.empty()) {
+		taken.resize((getSpaceSize() + 63) / 64, 0);
+	}
+	if(isTaken) {
+		taken[index / 64] |= (uint64_t) 1 << (index % 64);
+	} else {
+		taken[index / 64] &= ~((uint64_t) 1 << (index % 64));
+	}
+}
+
+std::string TeleportLabelAllocator::allocate() {
+	const int64_t size = getSpaceSize();
+	// random::u64() uses a per-thread generator, unlike rand()
+	const int64_t start = random::u64() % size;
+	if(taken.empty()) {
+		return getLabel(start);
+	}
+	const int64_t numWords = taken.size();
+	int64_t word = start / 64;
+	// ignore the bits before start in the first word
+	uint64_t free = ~taken[word] & (~(uint64_t) 0 << (start % 64));
+	for(int64_t i = 0; i <= numWords; i++) {
+		if(free) {
+			int64_t index = word * 64 + __builtin_ctzll(free);
+			if(index < size) {
+				return getLabel(index);
+			}
+		}
+		word = (word + 1) % numWords;
+		free = ~taken[word];
+	}
+	// every single label is taken
+	return "";
+}
+
 /////////////
 // modules //
 /////////////
@@ -14,14 +115,7 @@ struct TeleportInModule : Teleport {
 	};
 	enum InputIds {
 		INPUT_1,
-		INPUT_2,
-		INPUT_3,
-		INPUT_4,
-		INPUT_5,
-		INPUT_6,
-		INPUT_7,
-		INPUT_8,
-		NUM_INPUTS
+		NUM_INPUTS = INPUT_1 + TELEPORT_MAX_PORTS
 	};
 	enum OutputIds {
 		NUM_OUTPUTS
@@ -30,177 +124,2068 @@ struct TeleportInModule : Teleport {
 		NUM_LIGHTS
 	};
 
-	// Generate random, unique label for this teleport endpoint. Don't modify the sources map.
-	std::string getLabel() {
-		std::string l;
-		do {
-			l = randomString(EditableTextBox::defaultMaxTextLength);
-		} while(sourceExists(l)); // if the label exists, regenerate
-		return l;
-	}
-
 	// Change the label of this input, if the label doesn't exist already.
 	// Return whether the label was updated.
 	bool updateLabel(std::string lbl) {
 		if(lbl.empty() || sourceExists(lbl)) {
 			return false;
 		}
-		sources.erase(label); //TODO: mutex for this and erase() calls below?
+		removeSource(this);
 		label = lbl;
 		addSource(this);
+		updateSharing();
+		stats.increment(stats.labelChanges);
 		return true;
 	}
 
+	TeleportSourceStats stats;
+
+	// Share this source with other Rack instances through shared memory.
+	bool shared = false;
+	// The shared memory segment could not be created, most likely because
+	// another instance already shares the same label.
+	bool shareFailed = false;
+	std::atomic<TeleportShmWriter*> shmWriter{NULL};
+
+	// (Re)create or remove the shared memory segment according to shared and
+	// label. GUI thread only.
+	void updateSharing() {
+		TeleportShmWriter *old = shmWriter.exchange(NULL);
+		if(old) {
+			// unlink right away so that the label can be reused immediately,
+			// but keep the mapping around until process() is done with it
+			old->segment->unlink();
+			retire(old);
+		}
+		shareFailed = false;
+		if(shared) {
+			float sampleRate = (APP && APP->engine) ? APP->engine->getSampleRate() : 0.f;
+			TeleportShmSegment *segment = TeleportShmSegment::create(label, sampleRate, numPorts);
+			if(segment) {
+				shmWriter.store(new TeleportShmWriter(segment));
+			} else {
+				shareFailed = true;
+			}
+		}
+	}
+
 	TeleportInModule() : Teleport(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
-		assert(NUM_INPUTS == NUM_TELEPORT_INPUTS);
-		for(int i = 0; i < NUM_TELEPORT_INPUTS; i++) {
+		for(int i = 0; i < TELEPORT_MAX_PORTS; i++) {
 			configInput(i, string::f("Port %d", i + 1));
+			gains[i].store(1.f);
+			offsets[i].store(0.f);
+			inverted[i].store(false);
+			history[i].store(new TeleportHistory(2));
+			requestedDelay[i].store(1);
+		}
+		beginPaste();
+		addSourceWithNewLabel(this);
+	}
+
+	// Change the number of ports in use. The widget hides the other ports and
+	// removes their cables. GUI thread only.
+	void setNumPorts(int n) {
+		numPorts = clamp(n, 1, TELEPORT_MAX_PORTS);
+		// the shared segment has room for a fixed number of ports
+		updateSharing();
+	}
+
+	// Besides being a source of its own, this module can add its signals to
+	// a send bus shared with other sources. Outputs returning the bus get the
+	// sum of all of them. GUI thread only.
+	std::string sendBus;
+	std::atomic<int> sendBusId{-1}; // label ID of the bus we're registered to, -1 if none
+
+	void setSendBus(std::string bus) {
+		removeSender(this);
+		sendBus = bus;
+		addSender(this);
+	}
+
+	// The senders of a bus are sorted by module ID, which isn't final until
+	// the module has been added to the engine (e.g. when pasting).
+	void onAdd(const AddEvent& e) override {
+		setSendBus(sendBus);
+	}
+
+	// Unregister as soon as the module is removed from the engine. This is
+	// called while the engine is locked, so no output can be in the middle of
+	// reading from this module, and they will all see the new snapshot before
+	// the module is deleted.
+	void onRemove(const RemoveEvent& e) override {
+		removeSource(this);
+		removeSender(this);
+	}
+
+	// Recording everything arriving at this source to a file, see TeleportRecorder.hpp.
+	std::atomic<TeleportRecorder*> recorder{NULL};
+	int recordLayout = RECORD_MONO;
+	uint64_t lastRecordingDropped = 0;
+
+	// GUI thread only. Return false if the file couldn't be opened.
+	bool startRecording(std::string path) {
+		stopRecording();
+		std::string ext = string::lowercase(system::getExtension(path));
+		int format = (ext == ".wav" || ext == "wav") ? RECORD_WAV : RECORD_RAW;
+		float sampleRate = (APP && APP->engine) ? APP->engine->getSampleRate() : 44100.f;
+		TeleportRecorder *r = TeleportRecorder::start(path, format, recordLayout, numPorts, sampleRate);
+		recorder.store(r);
+		return r != NULL;
+	}
+
+	void stopRecording() {
+		TeleportRecorder *r = recorder.exchange(NULL);
+		if(r) {
+			r->stop();
+			lastRecordingDropped = r->framesDropped.load();
+			retire(r);
+		}
+	}
+
+	void onSampleRateChange(const SampleRateChangeEvent& e) override {
+		TeleportShmWriter *writer = shmWriter.load();
+		if(writer) {
+			writer->segment->header->sampleRate = e.sampleRate;
 		}
-		label = getLabel();
-		addSource(this);
 	}
 
 	~TeleportInModule() {
-		sources.erase(label);
+		removeSource(this);
+		removeSender(this);
+		// not in the engine anymore, so nobody can be using these
+		delete shmWriter.load();
+		delete recorder.load();
+		delete liveFrame;
+		for(int i = 0; i < TELEPORT_MAX_PORTS; i++) {
+			delete history[i].load();
+		}
+	}
+
+	// Spread the channels of the first input over the ports, one channel per
+	// port, like a Split module. See also TeleportOutModule::polyPack.
+	std::atomic<bool> polyUnpack{false};
+
+	// Applied to each port once when publishing, instead of in every output.
+	// A gain of 1 and offset of 0 leave the port untouched. Like the other
+	// settings, these are atomic because the GUI thread changes them while
+	// process() reads them.
+	std::atomic<float> gains[TELEPORT_MAX_PORTS];
+	std::atomic<float> offsets[TELEPORT_MAX_PORTS];
+	std::atomic<bool> inverted[TELEPORT_MAX_PORTS];
+
+	// The signals of the current frame, for live outputs. Outputs on other
+	// threads read this instead of our inputs, which share cache lines with
+	// state the engine writes from other cores. Only written in process().
+	TeleportFrame *liveFrame = new TeleportFrame();
+	int livePorts = 0; // ports written to liveFrame in the last process()
+
+	// History of each port, for deterministic and delayed outputs. Only
+	// written while such outputs exist, see publishFrame(). Each ring
+	// starts out with room for a delay of one sample and grows when outputs
+	// ask for more, see requestDelay().
+	std::atomic<TeleportHistory*> history[TELEPORT_MAX_PORTS];
+	// The largest delay any output has asked for, per port. Outputs raise
+	// these from their process(), the rings are grown from the GUI thread.
+	std::atomic<int> requestedDelay[TELEPORT_MAX_PORTS];
+
+	// Make sure the history of port can be read with the given delay. Safe to
+	// call from any thread, the ring is only grown by maintainHistory().
+	void requestDelay(int port, int delay) {
+		int current = requestedDelay[port].load(std::memory_order_relaxed);
+		while(delay > current && !requestedDelay[port].compare_exchange_weak(current, delay, std::memory_order_relaxed)) {}
+	}
+
+	// Grow the history rings to fit the requested delays. GUI thread only.
+	void maintainHistory() {
+		for(int i = 0; i < numPorts; i++) {
+			const int delay = std::min(requestedDelay[i].load(std::memory_order_relaxed), TELEPORT_MAX_DELAY);
+			TeleportHistory *h = history[i].load();
+			if(delay < h->size) {
+				continue;
+			}
+			int size = h->size;
+			while(size <= delay) {
+				size *= 2;
+			}
+			// Carry the recent frames over, so that outputs already reading
+			// this port don't miss a beat. Outputs with a longer delay get
+			// nothing until the new ring has filled up. The source may publish
+			// to the old ring until it sees the new one, catch up with that
+			// afterwards.
+			TeleportHistory *grown = new TeleportHistory(size);
+			grown->copyFrom(*h);
+			history[i].store(grown);
+			grown->copyFrom(*h);
+			retire(h);
+		}
+	}
+
+	// Push the live signals to all outputs that have selected this label, and
+	// publish the frame for deterministic and delayed outputs.
+	void process(const ProcessArgs &args) override {
+		publishFrame(args.frame);
 	}
 
-	// process() is not needed for a teleport source, values are read directly from inputs by teleport out
+	// A bypassed teleport still teleports, same as in the default mode.
+	void processBypass(const ProcessArgs &args) override {
+		publishFrame(args.frame);
+	}
+
+	void publishFrame(int64_t frame) {
+		if(polyUnpack) {
+			unpackInput();
+		} else {
+			processInputs();
+		}
+		// Most sources are only read live, skip the history then. An output
+		// that starts reading it finds the slots stale until they're written.
+		const TeleportSnapshot *s = snapshot.load(std::memory_order_acquire);
+		const bool keepHistory = s->hasHistoryReaders(labelId.load(std::memory_order_relaxed))
+			|| s->hasHistoryReaders(sendBusId.load(std::memory_order_relaxed));
+		int totalChannels = 0;
+		for(int i = 0; i < numPorts; i++) {
+			const int channels = liveFrame->channels[i];
+			if(keepHistory) {
+				TeleportHistory *h = history[i].load(std::memory_order_acquire);
+				h->write(frame, liveFrame->voltages[i], channels);
+			}
+			totalChannels += channels;
+		}
+		// ports that were just removed are silent from now on
+		for(int i = numPorts; i < livePorts; i++) {
+			liveFrame->channels[i] = 0;
+		}
+		livePorts = numPorts;
+		stats.increment(stats.framesPublished);
+		stats.increment(stats.channelsPublished, totalChannels);
+
+		TeleportShmWriter *writer = shmWriter.load(std::memory_order_acquire);
+		if(writer) {
+			writer->write(liveFrame);
+		}
+		TeleportRecorder *r = recorder.load(std::memory_order_acquire);
+		if(r) {
+			r->push(&inputs[INPUT_1]);
+		}
+		pushToSubscribers(frame);
+	}
+
+	inline float getGain(int i) {
+		const float gain = gains[i].load(std::memory_order_relaxed);
+		return inverted[i].load(std::memory_order_relaxed) ? -gain : gain;
+	}
+
+	// Copy the inputs to liveFrame, applying the gain and offset.
+	void processInputs() {
+		for(int i = 0; i < numPorts; i++) {
+			const int channels = inputs[INPUT_1 + i].getChannels();
+			const float *in = inputs[INPUT_1 + i].getVoltages();
+			float *v = liveFrame->voltages[i];
+			liveFrame->channels[i] = channels;
+			const float gain = getGain(i);
+			if(gain == 1.f && offsets[i] == 0.f) {
+				copyVoltages(v, in, channels);
+			} else {
+				const simd::float_4 offset = offsets[i].load(std::memory_order_relaxed);
+				for(int c = 0; c < channels; c += 4) {
+					(simd::float_4::load(in + c) * gain + offset).store(v + c);
+				}
+			}
+		}
+	}
+
+	// Same as processInputs(), but channel c of the first input goes to port c.
+	void unpackInput() {
+		Input &input = inputs[INPUT_1];
+		const int channels = std::min(input.getChannels(), numPorts.load());
+		const float *in = input.getVoltages();
+		for(int c = 0; c < channels; c += 4) {
+			// the gain and offset of four ports at once, then scatter
+			simd::float_4 gain(getGain(c), getGain(c + 1), getGain(c + 2), getGain(c + 3));
+			simd::float_4 offset(offsets[c].load(std::memory_order_relaxed), offsets[c + 1].load(std::memory_order_relaxed), offsets[c + 2].load(std::memory_order_relaxed), offsets[c + 3].load(std::memory_order_relaxed));
+			simd::float_4 v = simd::float_4::load(in + c) * gain + offset;
+			for(int k = 0; k < 4 && c + k < channels; k++) {
+				liveFrame->voltages[c + k][0] = v[k];
+				liveFrame->channels[c + k] = 1;
+			}
+		}
+		for(int i = channels; i < numPorts; i++) {
+			liveFrame->channels[i] = 0;
+		}
+	}
+
+	void pushToSubscribers(int64_t frame);
 
 	json_t* dataToJson() override {
 		json_t *data = json_object();
 		json_object_set_new(data, "label", json_string(label.c_str()));
+		json_object_set_new(data, "shared", json_boolean(shared));
+		json_object_set_new(data, "numPorts", json_integer(numPorts));
+		json_object_set_new(data, "sendBus", json_string(sendBus.c_str()));
+		json_object_set_new(data, "polyUnpack", json_boolean(polyUnpack));
+		json_t *gains_json = json_array();
+		json_t *offsets_json = json_array();
+		json_t *inverted_json = json_array();
+		for(int i = 0; i < numPorts; i++) {
+			json_array_append_new(gains_json, json_real(gains[i]));
+			json_array_append_new(offsets_json, json_real(offsets[i]));
+			json_array_append_new(inverted_json, json_boolean(inverted[i]));
+		}
+		json_object_set_new(data, "gains", gains_json);
+		json_object_set_new(data, "offsets", offsets_json);
+		json_object_set_new(data, "inverted", inverted_json);
 		return data;
 	}
 
 	void dataFromJson(json_t* root) override {
+		beginPaste();
 		json_t *label_json = json_object_get(root, "label");
+		// remove previous label randomly generated in constructor
+		removeSource(this);
 		if(json_is_string(label_json)) {
-			// remove previous label randomly generated in constructor
-			sources.erase(label);
-			label = std::string(json_string_value(label_json));
-			if(sourceExists(label)) {
+			std::string lbl = json_string_value(label_json);
+			if(sourceExists(lbl)) {
 				// Label already exists in sources, this means that dataFromJson()
-				// was called due to duplication instead of loading from file.
-				// Generate new label.
-				label = getLabel();
+				// was called due to duplication or pasting instead of loading
+				// from file. Generate new label.
+				addSourceWithNewLabel(this);
+				addPasteRename(lbl, label);
+			} else {
+				label = lbl;
+				addSource(this);
 			}
 		} else {
 			// label couldn't be read from json for some reason, generate new one
-			label = getLabel();
+			addSourceWithNewLabel(this);
+		}
+
+		json_t *shared_json = json_object_get(root, "shared");
+		if(json_is_boolean(shared_json)) {
+			shared = json_boolean_value(shared_json);
+		}
+		json_t *numPorts_json = json_object_get(root, "numPorts");
+		if(json_is_integer(numPorts_json)) {
+			numPorts = clamp((int) json_integer_value(numPorts_json), 1, TELEPORT_MAX_PORTS);
+		}
+		updateSharing();
+		json_t *sendBus_json = json_object_get(root, "sendBus");
+		if(json_is_string(sendBus_json)) {
+			setSendBus(json_string_value(sendBus_json));
+		}
+		json_t *polyUnpack_json = json_object_get(root, "polyUnpack");
+		if(json_is_boolean(polyUnpack_json)) {
+			polyUnpack = json_boolean_value(polyUnpack_json);
+		}
+		json_t *gains_json = json_object_get(root, "gains");
+		json_t *offsets_json = json_object_get(root, "offsets");
+		json_t *inverted_json = json_object_get(root, "inverted");
+		for(int i = 0; i < TELEPORT_MAX_PORTS; i++) {
+			json_t *gain_json = json_array_get(gains_json, i);
+			json_t *offset_json = json_array_get(offsets_json, i);
+			if(json_is_number(gain_json)) {
+				gains[i] = clamp((float) json_number_value(gain_json), -10.f, 10.f);
+			}
+			if(json_is_number(offset_json)) {
+				offsets[i] = clamp((float) json_number_value(offset_json), -10.f, 10.f);
+			}
+			inverted[i] = json_is_true(json_array_get(inverted_json, i));
+		}
+
+	}
+
+};
+
+struct TeleportOutModule : Teleport {
+
+	// Written by the engine, read by the label display.
+	std::atomic<bool> sourceIsValid{false};
+	// The settings are changed by the GUI thread while process() reads them,
+	// so they are all atomics.
+	//
+	// Read the frame committed by the source during the previous engine frame
+	// instead of reading its inputs directly. See TeleportInModule::history.
+	std::atomic<bool> deterministic{false};
+	// Additional delay of each port in samples, read from the history of the
+	// source. Delayed ports are always deterministic. Rounded to whole samples
+	// unless fractionalDelay is enabled, in which case the two nearest
+	// samples are interpolated linearly.
+	std::atomic<float> delays[TELEPORT_MAX_PORTS];
+	std::atomic<bool> fractionalDelay{false};
+
+	// The source is looked up by labelId only when the label or the sources
+	// snapshot changes.
+	TeleportInModule *src = NULL;
+	int resolvedLabelId = -1;
+	unsigned int resolvedVersion = 0;
+
+	dsp::ClockDivider lightDivider;
+
+	enum CvSmoothing {
+		CV_HOLD,
+		CV_LINEAR, // ramp to each new value over cvDivision samples
+		CV_ONE_POLE,
+		NUM_CV_SMOOTHINGS
+	};
+	// Ports in control rate mode are only read from the source once every
+	// cvDivision samples, which is plenty for slow CV. In between, the output
+	// holds the last value or glides towards it.
+	std::atomic<bool> cvRate[TELEPORT_MAX_PORTS];
+	std::atomic<int> cvDivision{32};
+	std::atomic<int> cvSmoothing{CV_LINEAR};
+	dsp::ClockDivider cvDivider;
+	float cvLambda = 0.f; // one-pole coefficient, depends on cvDivision
+	// Per channel, the increment per sample for linear smoothing or the target
+	// for one-pole smoothing.
+	float cvState[TELEPORT_MAX_PORTS][MAX_POLY_CHANNELS] = {};
+
+	// Receive from a source shared by another Rack instance instead of a
+	// local one, see TeleportShm.hpp. The label then refers to the remote source.
+	std::atomic<bool> remote{false};
+	std::atomic<int> shmLatency{256}; // frames
+	std::atomic<int> underrunPolicy{UNDERRUN_HOLD};
+	std::atomic<int> driftPolicy{DRIFT_SLIP};
+	std::atomic<TeleportShmReader*> shmReader{NULL};
+
+	TeleportLinkStats stats;
+
+	// The label ID under which this module is subscribed to its source. GUI
+	// thread only.
+	int subscribedId = -1;
+	// Label IDs of the sources or bus whose history we read, each counted
+	// once in TeleportSnapshot::historyReadersById. GUI thread only.
+	std::vector<int> historyIds;
+	// Ports the source copies straight into our outputs, because they are
+	// read live without any delay or control rate processing. Updated in
+	// every process(), read by the source.
+	std::atomic<uint64_t> pushMask{0};
+	// The engine frame of the last push from the source.
+	std::atomic<int64_t> pushedFrame{-1};
+
+	// In matrix mode, each output reads any port of any source instead of the
+	// same port of the selected source. The route of output i is
+	// labelId * TELEPORT_MAX_PORTS + port, or -1 if it isn't routed, so that
+	// it can be changed atomically. routeLabels is the GUI side of the same.
+	std::atomic<bool> matrix{false};
+	std::atomic<int> routes[TELEPORT_MAX_PORTS];
+	std::string routeLabels[TELEPORT_MAX_PORTS];
+	// When a route changes, the output fades from the previous route to the
+	// new one over crossfadeTime seconds. If it changes again in the middle
+	// of a fade, the whole mix so far keeps fading out: each route in it
+	// keeps its share of the outgoing level. Engine thread only, except
+	// crossfadeTime.
+	std::atomic<float> crossfadeTime{0.005f};
+	int activeRoutes[TELEPORT_MAX_PORTS];
+	float fades[TELEPORT_MAX_PORTS]; // level of the active route, 1 once the fade is done
+	// The routes fading out, and their shares of the outgoing level, which
+	// add up to 1.
+	int fadingRoutes[TELEPORT_MAX_PORTS][TELEPORT_MATRIX_FADES];
+	float fadingShares[TELEPORT_MAX_PORTS][TELEPORT_MATRIX_FADES];
+	int numFading[TELEPORT_MAX_PORTS] = {};
+	// The label ID of the previous route of each port, which is still read
+	// while fading out. Holds a reference to the ID until the next route
+	// change, see setRoute(). GUI thread only.
+	int fadingRouteIds[TELEPORT_MAX_PORTS];
+
+	// Return the sum of all sources sending to the send bus named by the
+	// label, see TeleportInModule::sendBus.
+	std::atomic<bool> busReturn{false};
+
+	// Output the first channel of each source port as one channel of the
+	// first output, like a Merge module. See also TeleportInModule::polyUnpack.
+	std::atomic<bool> polyPack{false};
+
+	enum ParamIds {
+		NUM_PARAMS
+	};
+	enum InputIds {
+		NUM_INPUTS
+	};
+	enum OutputIds {
+		OUTPUT_1,
+		NUM_OUTPUTS = OUTPUT_1 + TELEPORT_MAX_PORTS
+	};
+	enum LightIds {
+		OUTPUT_1_LIGHTG,
+		OUTPUT_1_LIGHTR,
+		NUM_LIGHTS = OUTPUT_1_LIGHTG + 2 * TELEPORT_MAX_PORTS
+	};
+
+	TeleportOutModule() : Teleport(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
+		for(int i = 0; i < TELEPORT_MAX_PORTS; i++) {
+			configOutput(i, string::f("Port %d", i + 1));
+			delays[i].store(0.f);
+			cvRate[i].store(false);
+			routes[i].store(-1);
+			fadingRouteIds[i] = -1;
+			activeRoutes[i] = -1;
+			fades[i] = 1.f;
+		}
+		beginPaste();
+		std::string lbl = "";
+		{
+			std::lock_guard<std::mutex> lock(writeMutex);
+			const TeleportSnapshot *s = getLatestLocked();
+			if(s->sources.size() > 0) {
+				if(s->sources.find(lastInsertedKey) != s->sources.end()) {
+					lbl = lastInsertedKey;
+				} else {
+					// the lastly added input doesn't exist anymore,
+					// pick first input in alphabetical order
+					lbl = s->sources.begin()->first;
+				}
+			}
+		}
+		setLabel(lbl);
+		sourceIsValid = !lbl.empty();
+		resolveSource(labelId.load());
+		lightDivider.setDivision(512);
+	}
+
+	~TeleportOutModule() {
+		unsubscribe(this, subscribedId);
+		changeHistoryReaders(historyIds, {});
+		releaseLabelId(labelId.exchange(-1));
+		for(int i = 0; i < TELEPORT_MAX_PORTS; i++) {
+			releaseLabelId(getRouteId(i));
+			releaseLabelId(fadingRouteIds[i]);
+		}
+		pastedOutputs.erase(std::remove(pastedOutputs.begin(), pastedOutputs.end(), this), pastedOutputs.end());
+		// not in the engine anymore, so nobody can be using the reader
+		delete shmReader.load();
+	}
+
+	// Stop receiving from the source as soon as the module is removed from
+	// the engine, same as TeleportInModule::onRemove().
+	void onRemove(const RemoveEvent& e) override {
+		unsubscribe(this, subscribedId);
+		subscribedId = -1;
+	}
+
+	// Subscribe to the source of the current label, and register as a
+	// reader of its history if needed. GUI thread only.
+	void updateSubscription() {
+		updateHistoryReads();
+		const int id = (remote || matrix || busReturn || polyPack) ? -1 : labelId.load();
+		if(id == subscribedId) {
+			return;
+		}
+		unsubscribe(this, subscribedId);
+		subscribe(this, id);
+		subscribedId = id;
+	}
+
+	// The label IDs whose history the current mode reads, see processPort(),
+	// processMatrix() and processBus().
+	std::vector<int> getHistoryIds() {
+		std::vector<int> ids;
+		if(remote) {
+			return ids;
+		}
+		if(matrix) {
+			for(int i = 0; i < numPorts && deterministic; i++) {
+				ids.push_back(getRouteId(i));
+				ids.push_back(fadingRouteIds[i]);
+			}
+		} else if(busReturn || deterministic) {
+			ids.push_back(labelId.load());
+		} else {
+			for(int i = 0; i < numPorts; i++) {
+				if(delays[i] > 0.f) {
+					ids.push_back(labelId.load());
+					break;
+				}
+			}
+		}
+		std::sort(ids.begin(), ids.end());
+		ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+		ids.erase(std::remove(ids.begin(), ids.end(), -1), ids.end());
+		return ids;
+	}
+
+	void updateHistoryReads() {
+		std::vector<int> ids = getHistoryIds();
+		if(ids != historyIds) {
+			changeHistoryReaders(historyIds, ids);
+			historyIds = ids;
+		}
+	}
+
+	// Called from the process() of the source, possibly on another thread.
+	//
+	// The source loads pushMask once per frame, so a change only takes effect
+	// in the next frame. Until then, both may write the same output during
+	// one frame. That happens when the source pushes while we read the port
+	// ourselves because no push arrived in time (e.g. right after
+	// subscribing), or right after switching to a mode that doesn't use
+	// pushes. The port then carries either signal for that one sample. A port
+	// that is merely switched away from live reading is safe: we still skip
+	// it in the frame where its bit is cleared.
+	void receive(TeleportInModule *source, int64_t frame) {
+		// only visit the set bits, most of a wide bus is usually unused
+		for(uint64_t mask = pushMask.load(std::memory_order_relaxed); mask; mask &= mask - 1) {
+			const int i = __builtin_ctzll(mask);
+			Output &output = outputs[OUTPUT_1 + i];
+			const int channels = source->liveFrame->channels[i];
+			output.setChannels(channels);
+			copyVoltages(output.getVoltages(), source->liveFrame->voltages[i], channels);
+		}
+		pushedFrame.store(frame, std::memory_order_relaxed);
+	}
+
+	void setLabel(std::string lbl) {
+		label = lbl;
+		const int previousId = labelId.exchange(lbl.empty() ? -1 : acquireLabelId(lbl));
+		updateSubscription();
+		releaseLabelId(previousId);
+		if(remote) {
+			updateRemote();
+		} else {
+			requestDelays();
+		}
+	}
+
+	// (Re)connect to or disconnect from the remote source according to remote
+	// and label. GUI thread only.
+	void updateRemote() {
+		retire(shmReader.exchange(NULL));
+		if(remote && !label.empty()) {
+			TeleportShmSegment *segment = TeleportShmSegment::open(label);
+			if(segment) {
+				shmReader.store(new TeleportShmReader(segment));
+			}
+		}
+	}
+
+	// Called periodically from the GUI thread, to connect to remote sources
+	// that appeared after we tried the first time, and to reconnect when the
+	// other instance has recreated the source.
+	void maintainRemote() {
+		if(!remote) {
+			return;
+		}
+		TeleportShmReader *reader = shmReader.load();
+		if(!reader || !reader->isCurrent()) {
+			updateRemote();
+		}
+	}
+
+	// Look up the source in the current snapshot. The snapshot is only used
+	// within this process() call, see Teleport::retired.
+	void resolveSource(int id) {
+		const TeleportSnapshot *s = snapshot.load(std::memory_order_acquire);
+		resolvedLabelId = id;
+		resolvedVersion = s->version;
+		if(id >= 0 && id < (int) s->sourcesById.size()) {
+			src = s->sourcesById[id];
+		} else {
+			src = NULL;
+		}
+	}
+
+	void process(const ProcessArgs &args) override {
+
+		if(remote || matrix || busReturn) {
+			// the source may not have seen the unsubscription yet
+			pushMask.store(0, std::memory_order_relaxed);
+		}
+
+		if(remote) {
+			processRemote();
+			if(lightDivider.process()) {
+				updateLights(args.frame);
+			}
+			return;
+		}
+
+		if(matrix) {
+			processMatrix(args);
+			if(lightDivider.process()) {
+				updateMatrixLights();
+			}
+			return;
+		}
+
+		if(busReturn) {
+			processBus(args.frame);
+			if(lightDivider.process()) {
+				updateBusLights(args.frame);
+			}
+			return;
+		}
+
+		int id = labelId.load(std::memory_order_relaxed);
+		if(resolvedVersion != sourcesVersion.load(std::memory_order_acquire) || resolvedLabelId != id) {
+			resolveSource(id);
+		}
+
+		if(src) {
+			if((int) cvDivider.getDivision() != cvDivision) {
+				cvDivider.setDivision(cvDivision);
+				// reach ~95% of each new value within cvDivision samples
+				cvLambda = 1.f - std::exp(-3.f / cvDivision);
+			}
+			const bool cvTick = cvDivider.process();
+			if(polyPack) {
+				processPack(args.frame);
+				sourceIsValid.store(true, std::memory_order_relaxed);
+				countDelivered();
+				if(lightDivider.process()) {
+					updateLights(args.frame);
+				}
+				return;
+			}
+			// If the source has pushed during this or the previous frame,
+			// it has taken care of the live ports. Otherwise (e.g. it hasn't
+			// seen our subscription yet) read them here.
+			const bool pushed = pushedFrame.load(std::memory_order_relaxed) >= args.frame - 1;
+			const uint64_t pushedPorts = pushed ? pushMask.load(std::memory_order_relaxed) : 0;
+			uint64_t livePorts = 0;
+			for(int i = 0; i < numPorts; i++) {
+				const bool live = !deterministic && !cvRate[i] && delays[i] <= 0.f;
+				livePorts |= (uint64_t) live << i;
+				if(pushedPorts & ((uint64_t) 1 << i)) {
+					continue;
+				} else if(!cvRate[i]) {
+					processPort(i, args.frame);
+				} else if(cvTick) {
+					sampleCvPort(i, args.frame);
+				} else {
+					smoothCvPort(i);
+				}
+			}
+			pushMask.store(livePorts, std::memory_order_relaxed);
+			sourceIsValid.store(true, std::memory_order_relaxed);
+			countDelivered();
+		} else {
+			for(int i = 0; i < numPorts; i++) {
+				outputs[OUTPUT_1 + i].setChannels(1);
+				outputs[OUTPUT_1 + i].setVoltage(0.f);
+			}
+			sourceIsValid.store(false, std::memory_order_relaxed);
+			stats.increment(stats.missingSourceFrames);
+		}
+
+		if(lightDivider.process()) {
+			updateLights(args.frame);
+		}
+	};
+
+	void processPort(int i, int64_t frame) {
+		const float delay = delays[i];
+		if(delay > 0.f && fractionalDelay) {
+			const float d = std::max(delay, 1.f);
+			processDelayed(i, frame, (int) d, d - (int) d);
+		} else if(delay > 0.f) {
+			processDelayed(i, frame, std::max((int) std::round(delay), 1), 0.f);
+		} else if(deterministic) {
+			processDelayed(i, frame, 1, 0.f);
+		} else {
+			processLive(i);
+		}
+	}
+
+	// Read a new value of a control rate port from the source, and set up
+	// the smoothing towards it.
+	void sampleCvPort(int i, int64_t frame) {
+		Output &output = outputs[OUTPUT_1 + i];
+		const int previousChannels = output.getChannels();
+		float previous[MAX_POLY_CHANNELS];
+		copyVoltages(previous, output.getVoltages(), previousChannels);
+
+		processPort(i, frame);
+		const int channels = output.getChannels();
+		float *v = output.getVoltages();
+		if(cvSmoothing == CV_HOLD || channels != previousChannels) {
+			// jump straight to the new value
+			for(int c = 0; c < channels; c += 4) {
+				(cvSmoothing == CV_LINEAR ? simd::float_4(0.f) : simd::float_4::load(v + c)).store(cvState[i] + c);
+			}
+			return;
+		}
+		for(int c = 0; c < channels; c += 4) {
+			simd::float_4 from = simd::float_4::load(previous + c);
+			simd::float_4 to = simd::float_4::load(v + c);
+			if(cvSmoothing == CV_LINEAR) {
+				simd::float_4 step = (to - from) / (float) cvDivision;
+				step.store(cvState[i] + c);
+				(from + step).store(v + c);
+			} else {
+				to.store(cvState[i] + c);
+				(from + (to - from) * cvLambda).store(v + c);
+			}
+		}
+	}
+
+	// Advance a control rate port by one sample between reads.
+	void smoothCvPort(int i) {
+		if(cvSmoothing == CV_HOLD) {
+			// the output keeps its voltages
+			return;
+		}
+		Output &output = outputs[OUTPUT_1 + i];
+		const int channels = output.getChannels();
+		float *v = output.getVoltages();
+		for(int c = 0; c < channels; c += 4) {
+			simd::float_4 out = simd::float_4::load(v + c);
+			simd::float_4 state = simd::float_4::load(cvState[i] + c);
+			if(cvSmoothing == CV_LINEAR) {
+				out += state;
+			} else {
+				out += (state - out) * cvLambda;
+			}
+			out.store(v + c);
+		}
+	}
+
+	// Gather the first channel of each port of the source into the channels
+	// of the first output, see polyPack. The other outputs are silent.
+	void processPack(int64_t frame) {
+		const int channels = std::min(src->numPorts.load(), MAX_POLY_CHANNELS);
+		Output &output = outputs[OUTPUT_1];
+		output.setChannels(channels);
+		float *out = output.getVoltages();
+		for(int c = 0; c < channels; c += 4) {
+			// gather the first channel of four ports, and zero the ones
+			// that are empty or past the last port
+			simd::float_4 v, n;
+			for(int k = 0; k < 4; k++) {
+				const int port = c + k;
+				if(deterministic) {
+					const TeleportHistory *h = src->history[port].load(std::memory_order_acquire);
+					const int slot = h->getSlot(frame - 1);
+					const bool valid = h->hasFrame(slot, frame - 1);
+					v[k] = h->getVoltage(slot, 0);
+					n[k] = valid ? h->getChannels(slot) : 0;
+					if(!valid && port < channels) {
+						stats.increment(stats.staleReads);
+					}
+				} else {
+					v[k] = src->liveFrame->voltages[port][0];
+					n[k] = src->liveFrame->channels[port];
+				}
+				n[k] = port < channels ? n[k] : 0;
+			}
+			simd::ifelse(n > 0.f, v, 0.f).store(out + c);
+		}
+		for(int i = 1; i < numPorts; i++) {
+			outputs[OUTPUT_1 + i].setChannels(0);
+		}
+		pushMask.store(0, std::memory_order_relaxed);
+	}
+
+	// Bypassing silences the outputs. Rack clears them once when bypassing, but
+	// the source would keep pushing into them, so stop that and clear them on
+	// every sample, including anything pushed during the frame the mask was
+	// cleared in.
+	void processBypass(const ProcessArgs &args) override {
+		pushMask.store(0, std::memory_order_relaxed);
+		for(int i = 0; i < numPorts; i++) {
+			outputs[OUTPUT_1 + i].setChannels(0);
+		}
+	}
+
+	// Copy the source input straight to the output.
+	void processLive(int i) {
+		Output &output = outputs[OUTPUT_1 + i];
+		const int channels = src->liveFrame->channels[i];
+		output.setChannels(channels);
+		copyVoltages(output.getVoltages(), src->liveFrame->voltages[i], channels);
+	}
+
+	void processRemote() {
+		TeleportShmReader *reader = shmReader.load(std::memory_order_acquire);
+		if(reader) {
+			reader->read(&outputs[OUTPUT_1], numPorts, shmLatency, underrunPolicy, driftPolicy);
+			sourceIsValid.store(true, std::memory_order_relaxed);
+			countDelivered();
+		} else {
+			for(int i = 0; i < numPorts; i++) {
+				outputs[OUTPUT_1 + i].setChannels(1);
+				outputs[OUTPUT_1 + i].setVoltage(0.f);
+			}
+			sourceIsValid.store(false, std::memory_order_relaxed);
+			stats.increment(stats.missingSourceFrames);
+		}
+	}
+
+	// Set the route of output i to port of the source with label lbl, or
+	// remove it if lbl is empty. GUI thread only.
+	void setRoute(int i, std::string lbl, int port) {
+		const int previousId = getRouteId(i);
+		routeLabels[i] = lbl;
+		routes[i].store(lbl.empty() ? -1 : acquireLabelId(lbl) * TELEPORT_MAX_PORTS + port);
+		// the reference to the previous route moves over to the fade
+		const int previousFadingId = fadingRouteIds[i];
+		fadingRouteIds[i] = previousId;
+		updateHistoryReads();
+		releaseLabelId(previousFadingId);
+	}
+
+	int getRouteId(int i) {
+		const int route = routes[i].load();
+		return route < 0 ? -1 : route / TELEPORT_MAX_PORTS;
+	}
+
+	int getRoutePort(int i) {
+		const int route = routes[i].load();
+		return route < 0 ? -1 : route % TELEPORT_MAX_PORTS;
+	}
+
+	// Follow a source that was renamed while pasting, see Teleport::pasteRenames.
+	void renameRoutes(std::string from, std::string to) {
+		for(int i = 0; i < TELEPORT_MAX_PORTS; i++) {
+			if(!routeLabels[i].empty() && routeLabels[i] == from) {
+				setRoute(i, to, getRoutePort(i));
+			}
+		}
+	}
+
+	// Return the voltages of a routed port, and set channels to its channel
+	// count. NULL if the source doesn't exist (or in deterministic mode,
+	// hasn't committed the previous frame). In deterministic mode they are
+	// copied to buffer, which must hold MAX_POLY_CHANNELS.
+	const float* readRoute(const TeleportSnapshot *s, int route, int64_t frame, float *buffer, int &channels) {
+		channels = 0;
+		if(route < 0) {
+			return NULL;
+		}
+		const int id = route / TELEPORT_MAX_PORTS;
+		const int port = route % TELEPORT_MAX_PORTS;
+		TeleportInModule *source = id < (int) s->sourcesById.size() ? s->sourcesById[id] : NULL;
+		if(!source) {
+			return NULL;
 		}
+		if(deterministic) {
+			const TeleportHistory *h = source->history[port].load(std::memory_order_acquire);
+			const int slot = h->getSlot(frame - 1);
+			if(!h->hasFrame(slot, frame - 1)) {
+				stats.increment(stats.staleReads);
+				return NULL;
+			}
+			channels = h->getChannels(slot);
+			h->readVoltages(slot, buffer, channels);
+			return buffer;
+		}
+		channels = source->liveFrame->channels[port];
+		return source->liveFrame->voltages[port];
+	}
+
+	// Four lanes of v starting at channel c, with the lanes at and above
+	// channels zeroed. v may be NULL.
+	static inline simd::float_4 loadLanes(const float *v, int channels, int c) {
+		if(!v || c >= channels) {
+			return 0.f;
+		}
+		simd::float_4 x = simd::float_4::load(v + c);
+		if(c + 4 > channels) {
+			x = simd::ifelse(simd::float_4(c, c + 1, c + 2, c + 3) < (float) channels, x, 0.f);
+		}
+		return x;
+	}
+
+	void processMatrix(const ProcessArgs &args) {
+		const TeleportSnapshot *s = snapshot.load(std::memory_order_acquire);
+		const float fadeStep = crossfadeTime > 0.f ? args.sampleTime / crossfadeTime : 1.f;
+		for(int i = 0; i < numPorts; i++) {
+			const int route = routes[i].load(std::memory_order_relaxed);
+			if(route != activeRoutes[i]) {
+				startFade(i, route);
+			}
+			Output &output = outputs[OUTPUT_1 + i];
+			int channels;
+			float buffer[MAX_POLY_CHANNELS];
+			const float *v = readRoute(s, route, args.frame, buffer, channels);
+			if(fades[i] >= 1.f) {
+				output.setChannels(channels);
+				if(v) {
+					copyVoltages(output.getVoltages(), v, channels);
+				}
+				continue;
+			}
+
+			fades[i] = std::min(fades[i] + fadeStep, 1.f);
+			const float *previous[TELEPORT_MATRIX_FADES];
+			float previousBuffers[TELEPORT_MATRIX_FADES][MAX_POLY_CHANNELS];
+			int previousChannels[TELEPORT_MATRIX_FADES];
+			int outChannels = channels;
+			for(int k = 0; k < numFading[i]; k++) {
+				previous[k] = readRoute(s, fadingRoutes[i][k], args.frame, previousBuffers[k], previousChannels[k]);
+				outChannels = std::max(outChannels, previousChannels[k]);
+			}
+			const simd::float_4 g = fades[i];
+			output.setChannels(outChannels);
+			float *out = output.getVoltages();
+			for(int c = 0; c < outChannels; c += 4) {
+				simd::float_4 mix = loadLanes(v, channels, c) * g;
+				for(int k = 0; k < numFading[i]; k++) {
+					mix += loadLanes(previous[k], previousChannels[k], c) * ((1.f - fades[i]) * fadingShares[i][k]);
+				}
+				mix.store(out + c);
+			}
+		}
+		sourceIsValid.store(true, std::memory_order_relaxed);
+		countDelivered();
+	}
+
+	// Start fading port i over to route. What the port is outputting now,
+	// possibly itself a fade, becomes the outgoing mix.
+	void startFade(int i, int route) {
+		const float g = fades[i];
+		int n = 0;
+		for(int k = 0; k < numFading[i]; k++) {
+			const float share = fadingShares[i][k] * (1.f - g);
+			if(share > 0.f) {
+				fadingRoutes[i][n] = fadingRoutes[i][k];
+				fadingShares[i][n] = share;
+				n++;
+			}
+		}
+		if(n == TELEPORT_MATRIX_FADES) {
+			// Too many changes within one fade, drop the quietest route. This
+			// is the only case that isn't click-free.
+			int quietest = 0;
+			for(int k = 1; k < n; k++) {
+				if(fadingShares[i][k] < fadingShares[i][quietest]) {
+					quietest = k;
+				}
+			}
+			n--;
+			fadingRoutes[i][quietest] = fadingRoutes[i][n];
+			fadingShares[i][quietest] = fadingShares[i][n];
+		}
+		fadingRoutes[i][n] = activeRoutes[i];
+		fadingShares[i][n] = g;
+		n++;
+		float total = 0.f;
+		for(int k = 0; k < n; k++) {
+			total += fadingShares[i][k];
+		}
+		for(int k = 0; k < n && total > 0.f; k++) {
+			fadingShares[i][k] /= total;
+		}
+		numFading[i] = n;
+		activeRoutes[i] = route;
+		fades[i] = 0.f;
+	}
+
+	const std::vector<TeleportInModule*>* getSenders(const TeleportSnapshot *s) {
+		const int id = labelId.load(std::memory_order_relaxed);
+		if(id < 0 || id >= (int) s->sendersById.size() || s->sendersById[id].empty()) {
+			return NULL;
+		}
+		return &s->sendersById[id];
+	}
+
+	// Sum what the senders of the bus committed during the previous frame.
+	// Reading the previous frame makes the result independent of module
+	// order and threading, and the senders are always summed in the same
+	// order, so the result is reproducible down to the last bit.
+	void processBus(int64_t frame) {
+		const TeleportSnapshot *s = snapshot.load(std::memory_order_acquire);
+		const std::vector<TeleportInModule*> *senders = getSenders(s);
+		if(!senders) {
+			for(int i = 0; i < numPorts; i++) {
+				outputs[OUTPUT_1 + i].setChannels(1);
+				outputs[OUTPUT_1 + i].setVoltage(0.f);
+			}
+			sourceIsValid.store(false, std::memory_order_relaxed);
+			stats.increment(stats.missingSourceFrames);
+			return;
+		}
+
+		const int64_t f = frame - 1;
+		for(int i = 0; i < numPorts; i++) {
+			simd::float_4 sum[MAX_POLY_CHANNELS / 4];
+			for(int k = 0; k < MAX_POLY_CHANNELS / 4; k++) {
+				sum[k] = 0.f;
+			}
+			int channels = 0;
+			for(TeleportInModule *sender : *senders) {
+				if(i >= sender->numPorts.load(std::memory_order_relaxed)) {
+					// the sender doesn't have this port, it's never committed
+					continue;
+				}
+				const TeleportHistory *h = sender->history[i].load(std::memory_order_acquire);
+				const int slot = h->getSlot(f);
+				if(!h->hasFrame(slot, f)) {
+					stats.increment(stats.staleReads);
+					continue;
+				}
+				const int senderChannels = h->getChannels(slot);
+				float v[MAX_POLY_CHANNELS];
+				h->readVoltages(slot, v, senderChannels);
+				for(int c = 0; c < senderChannels; c += 4) {
+					sum[c / 4] += loadLanes(v, senderChannels, c);
+				}
+				channels = std::max(channels, senderChannels);
+			}
+			Output &output = outputs[OUTPUT_1 + i];
+			output.setChannels(channels);
+			float *out = output.getVoltages();
+			for(int c = 0; c < channels; c += 4) {
+				sum[c / 4].store(out + c);
+			}
+		}
+		sourceIsValid.store(true, std::memory_order_relaxed);
+		countDelivered();
+	}
+
+	void countDelivered() {
+		int channels = 0;
+		for(int i = 0; i < numPorts; i++) {
+			channels += outputs[OUTPUT_1 + i].getChannels();
+		}
+		stats.increment(stats.framesDelivered);
+		stats.increment(stats.channelsMoved, channels);
+	}
+
+	// Copy what the source committed delay frames ago, delay >= 1. If frac
+	// is nonzero, interpolate towards the frame before that.
+	void processDelayed(int i, int64_t frame, int delay, float frac) {
+		Output &output = outputs[OUTPUT_1 + i];
+		const TeleportHistory *h = src->history[i].load(std::memory_order_acquire);
+		const int needed = delay + (frac > 0.f);
+		if(needed >= h->size) {
+			// the history is too short until the GUI thread has grown it
+			src->requestDelay(i, needed);
+			delay = std::min(delay, h->size - 1);
+			frac = 0.f;
+		}
+
+		const int64_t f0 = frame - delay;
+		const int s0 = h->getSlot(f0);
+		// If the source wasn't processed back then (e.g. it was just added
+		// or its history was just grown), there's nothing committed to read.
+		if(!h->hasFrame(s0, f0)) {
+			stats.increment(stats.staleReads);
+			output.setChannels(0);
+			return;
+		}
+		const int channels = h->getChannels(s0);
+		output.setChannels(channels);
+		const int s1 = h->getSlot(f0 - 1);
+		if(frac == 0.f || !h->hasFrame(s1, f0 - 1)) {
+			h->readVoltages(s0, output.getVoltages(), channels);
+			return;
+		}
+		float v0[MAX_POLY_CHANNELS], v1[MAX_POLY_CHANNELS];
+		h->readVoltages(s0, v0, channels);
+		h->readVoltages(s1, v1, channels);
+		float *out = output.getVoltages();
+		for(int c = 0; c < channels; c += 4) {
+			simd::float_4 a = simd::float_4::load(v0 + c);
+			simd::float_4 b = simd::float_4::load(v1 + c);
+			(a + (b - a) * frac).store(out + c);
+		}
+	}
+
+	// Set the delay of port i, and make sure the source can provide it right
+	// away. GUI thread only.
+	void setDelay(int i, float delay) {
+		// leave room for interpolating at the longest delay
+		delays[i] = clamp(delay, 0.f, (float) TELEPORT_MAX_DELAY - 1.f);
+		requestDelays();
+	}
+
+	// Change the number of ports in use, see TeleportInModule::setNumPorts().
+	void setNumPorts(int n) {
+		numPorts = clamp(n, 1, TELEPORT_MAX_PORTS);
+		requestDelays();
+	}
+
+	// Ask the current source for enough history for all delayed ports. GUI
+	// thread only.
+	void requestDelays() {
+		updateHistoryReads();
+		TeleportInModule *source = (remote || busReturn) ? NULL : getSource(label);
+		if(!source) {
+			return;
+		}
+		for(int i = 0; i < numPorts; i++) {
+			if(delays[i] > 0.f) {
+				// one more for interpolation
+				source->requestDelay(i, (int) std::ceil(delays[i]) + 1);
+			}
+		}
+		source->maintainHistory();
+	}
+
+	// Lights only need to be updated at UI rate, not every sample.
+	void updateLights(int64_t frame) {
+		TeleportShmReader *reader = remote ? shmReader.load(std::memory_order_acquire) : NULL;
+		const bool valid = remote ? reader != NULL : src != NULL;
+		for(int i = 0; i < numPorts; i++) {
+			bool connected = false;
+			if(reader) {
+				connected = reader->channels[i] > 0;
+			} else if(remote) {
+				connected = false;
+			} else if(src && (deterministic || delays[i] > 0.f)) {
+				const TeleportHistory *h = src->history[i].load(std::memory_order_acquire);
+				const int slot = h->getSlot(frame - 1);
+				connected = h->hasFrame(slot, frame - 1) && h->getChannels(slot) > 0;
+			} else if(src) {
+				connected = src->inputs[TeleportInModule::INPUT_1 + i].isConnected();
+			}
+			lights[OUTPUT_1_LIGHTG + 2*i].setBrightness(valid &&  connected);
+			lights[OUTPUT_1_LIGHTR + 2*i].setBrightness(valid && !connected);
+		}
+	}
+
+	// Green if any sender has a signal on the port, red if there are no senders.
+	void updateBusLights(int64_t frame) {
+		const std::vector<TeleportInModule*> *senders = getSenders(snapshot.load(std::memory_order_acquire));
+		for(int i = 0; i < numPorts; i++) {
+			bool connected = false;
+			for(int k = 0; senders && k < (int) senders->size() && !connected; k++) {
+				const TeleportHistory *h = (*senders)[k]->history[i].load(std::memory_order_acquire);
+				const int slot = h->getSlot(frame - 1);
+				connected = h->hasFrame(slot, frame - 1) && h->getChannels(slot) > 0;
+			}
+			lights[OUTPUT_1_LIGHTG + 2*i].setBrightness(senders &&  connected);
+			lights[OUTPUT_1_LIGHTR + 2*i].setBrightness(senders && !connected);
+		}
+	}
+
+	// Green if the routed port has a cable, red if its source is missing.
+	void updateMatrixLights() {
+		const TeleportSnapshot *s = snapshot.load(std::memory_order_acquire);
+		for(int i = 0; i < numPorts; i++) {
+			const int route = routes[i].load(std::memory_order_relaxed);
+			const int id = route / TELEPORT_MAX_PORTS;
+			TeleportInModule *source = (route >= 0 && id < (int) s->sourcesById.size()) ? s->sourcesById[id] : NULL;
+			const bool connected = source && source->inputs[TeleportInModule::INPUT_1 + route % TELEPORT_MAX_PORTS].isConnected();
+			lights[OUTPUT_1_LIGHTG + 2*i].setBrightness(connected);
+			lights[OUTPUT_1_LIGHTR + 2*i].setBrightness(route >= 0 && !source);
+		}
+	}
+
+	json_t* dataToJson() override {
+		json_t *data = json_object();
+		json_object_set_new(data, "label", json_string(label.c_str()));
+		json_object_set_new(data, "deterministic", json_boolean(deterministic));
+		json_t *delays_json = json_array();
+		for(int i = 0; i < numPorts; i++) {
+			json_array_append_new(delays_json, json_real(delays[i]));
+		}
+		json_object_set_new(data, "delays", delays_json);
+		json_object_set_new(data, "fractionalDelay", json_boolean(fractionalDelay));
+		json_t *cvRate_json = json_array();
+		for(int i = 0; i < numPorts; i++) {
+			json_array_append_new(cvRate_json, json_boolean(cvRate[i]));
+		}
+		json_object_set_new(data, "cvRate", cvRate_json);
+		json_object_set_new(data, "cvDivision", json_integer(cvDivision));
+		json_object_set_new(data, "cvSmoothing", json_integer(cvSmoothing));
+		json_object_set_new(data, "remote", json_boolean(remote));
+		json_object_set_new(data, "shmLatency", json_integer(shmLatency));
+		json_object_set_new(data, "underrunPolicy", json_integer(underrunPolicy));
+		json_object_set_new(data, "driftPolicy", json_integer(driftPolicy));
+		json_object_set_new(data, "numPorts", json_integer(numPorts));
+		json_object_set_new(data, "matrix", json_boolean(matrix));
+		json_t *routes_json = json_array();
+		for(int i = 0; i < numPorts; i++) {
+			json_t *route_json = json_object();
+			json_object_set_new(route_json, "label", json_string(routeLabels[i].c_str()));
+			json_object_set_new(route_json, "port", json_integer(std::max(getRoutePort(i), 0)));
+			json_array_append_new(routes_json, route_json);
+		}
+		json_object_set_new(data, "routes", routes_json);
+		json_object_set_new(data, "crossfadeTime", json_real(crossfadeTime));
+		json_object_set_new(data, "busReturn", json_boolean(busReturn));
+		json_object_set_new(data, "polyPack", json_boolean(polyPack));
+		return data;
+	}
+
+	void dataFromJson(json_t* root) override {
+		beginPaste();
+		// read matrix and busReturn first, updateSubscription() depends on them
+		json_t *matrix_json = json_object_get(root, "matrix");
+		if(json_is_boolean(matrix_json)) {
+			matrix = json_boolean_value(matrix_json);
+		}
+		json_t *busReturn_json = json_object_get(root, "busReturn");
+		if(json_is_boolean(busReturn_json)) {
+			busReturn = json_boolean_value(busReturn_json);
+		}
+		json_t *polyPack_json = json_object_get(root, "polyPack");
+		if(json_is_boolean(polyPack_json)) {
+			polyPack = json_boolean_value(polyPack_json);
+		}
+		json_t *routes_json = json_object_get(root, "routes");
+		if(json_is_array(routes_json)) {
+			for(int i = 0; i < TELEPORT_MAX_PORTS && i < (int) json_array_size(routes_json); i++) {
+				json_t *route_json = json_array_get(routes_json, i);
+				json_t *routeLabel_json = json_object_get(route_json, "label");
+				json_t *routePort_json = json_object_get(route_json, "port");
+				if(json_is_string(routeLabel_json) && json_is_integer(routePort_json)) {
+					setRoute(i, getPastedLabel(json_string_value(routeLabel_json), this),
+						clamp((int) json_integer_value(routePort_json), 0, TELEPORT_MAX_PORTS - 1));
+				}
+			}
+		}
+		json_t *crossfade_json = json_object_get(root, "crossfadeTime");
+		if(json_is_number(crossfade_json)) {
+			crossfadeTime = clamp((float) json_number_value(crossfade_json), 0.f, 1.f);
+		}
+		// read remote first, setLabel() connects to the remote source
+		json_t *remote_json = json_object_get(root, "remote");
+		if(json_is_boolean(remote_json)) {
+			remote = json_boolean_value(remote_json);
+		}
+		json_t *label_json = json_object_get(root, "label");
+		if(json_is_string(label_json)) {
+			// bus names are shared on purpose, pasting doesn't rename them
+			const bool renamed = !remote && !busReturn;
+			setLabel(renamed ? getPastedLabel(json_string_value(label_json), this) : json_string_value(label_json));
+		}
+		json_t *deterministic_json = json_object_get(root, "deterministic");
+		if(json_is_boolean(deterministic_json)) {
+			deterministic = json_boolean_value(deterministic_json);
+		}
+		json_t *delays_json = json_object_get(root, "delays");
+		if(json_is_array(delays_json)) {
+			for(int i = 0; i < TELEPORT_MAX_PORTS && i < (int) json_array_size(delays_json); i++) {
+				json_t *delay_json = json_array_get(delays_json, i);
+				if(json_is_number(delay_json)) {
+					delays[i] = clamp((float) json_number_value(delay_json), 0.f, (float) TELEPORT_MAX_DELAY - 1.f);
+				}
+			}
+		}
+		json_t *fractional_json = json_object_get(root, "fractionalDelay");
+		if(json_is_boolean(fractional_json)) {
+			fractionalDelay = json_boolean_value(fractional_json);
+		}
+		json_t *cvRate_json = json_object_get(root, "cvRate");
+		if(json_is_array(cvRate_json)) {
+			for(int i = 0; i < TELEPORT_MAX_PORTS && i < (int) json_array_size(cvRate_json); i++) {
+				cvRate[i] = json_is_true(json_array_get(cvRate_json, i));
+			}
+		}
+		json_t *cvDivision_json = json_object_get(root, "cvDivision");
+		if(json_is_integer(cvDivision_json)) {
+			cvDivision = clamp((int) json_integer_value(cvDivision_json), 1, 4096);
+		}
+		json_t *cvSmoothing_json = json_object_get(root, "cvSmoothing");
+		if(json_is_integer(cvSmoothing_json)) {
+			cvSmoothing = clamp((int) json_integer_value(cvSmoothing_json), 0, NUM_CV_SMOOTHINGS - 1);
+		}
+		json_t *numPorts_json = json_object_get(root, "numPorts");
+		if(json_is_integer(numPorts_json)) {
+			numPorts = clamp((int) json_integer_value(numPorts_json), 1, TELEPORT_MAX_PORTS);
+		}
+		requestDelays();
+		json_t *latency_json = json_object_get(root, "shmLatency");
+		if(json_is_integer(latency_json)) {
+			shmLatency = clamp((int) json_integer_value(latency_json), 1, TELEPORT_SHM_CAPACITY / 2);
+		}
+		json_t *underrun_json = json_object_get(root, "underrunPolicy");
+		if(json_is_integer(underrun_json)) {
+			underrunPolicy = clamp((int) json_integer_value(underrun_json), 0, NUM_UNDERRUN_POLICIES - 1);
+		}
+		json_t *drift_json = json_object_get(root, "driftPolicy");
+		if(json_is_integer(drift_json)) {
+			driftPolicy = clamp((int) json_integer_value(drift_json), 0, NUM_DRIFT_POLICIES - 1);
+		}
+	}
+};
+
+void TeleportHistory::write(int64_t frame, const float *from, int numChannels) {
+	const int slot = getSlot(frame);
+	// The GUI thread may be copying this slot into a grown ring. Clear the
+	// stamp while the slot is being written, so that it notices.
+	stamps[slot].store(-1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	channels[slot].store(numChannels, std::memory_order_relaxed);
+	std::atomic<float> *to = &voltages[slot * MAX_POLY_CHANNELS];
+	for(int c = 0; c < (numChannels + 3) / 4 * 4; c++) {
+		to[c].store(from[c], std::memory_order_relaxed);
+	}
+	stamps[slot].store(frame, std::memory_order_release);
+}
+
+void TeleportHistory::copyFrom(const TeleportHistory &from) {
+	float v[MAX_POLY_CHANNELS];
+	for(int s = 0; s < from.size; s++) {
+		const int64_t stamp = from.stamps[s].load(std::memory_order_acquire);
+		if(stamp < 0 || stamps[getSlot(stamp)].load(std::memory_order_relaxed) >= stamp) {
+			continue;
+		}
+		// the source clears the stamp before writing a slot and sets it
+		// last, so if it's unchanged after copying, so is the frame
+		const int c = from.getChannels(s);
+		from.readVoltages(s, v, MAX_POLY_CHANNELS);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(from.stamps[s].load(std::memory_order_relaxed) != stamp) {
+			continue;
+		}
+		const int slot = getSlot(stamp);
+		channels[slot].store(c, std::memory_order_relaxed);
+		for(int k = 0; k < MAX_POLY_CHANNELS; k++) {
+			voltages[slot * MAX_POLY_CHANNELS + k].store(v[k], std::memory_order_relaxed);
+		}
+		stamps[slot].store(stamp, std::memory_order_release);
+	}
+}
+
+json_t* TeleportSourceStats::toJson() const {
+	json_t *data = json_object();
+	json_object_set_new(data, "framesPublished", json_integer(framesPublished.load()));
+	json_object_set_new(data, "channelsPublished", json_integer(channelsPublished.load()));
+	json_object_set_new(data, "framesPushed", json_integer(framesPushed.load()));
+	json_object_set_new(data, "labelChanges", json_integer(labelChanges.load()));
+	return data;
+}
+
+json_t* TeleportLinkStats::toJson() const {
+	json_t *data = json_object();
+	json_object_set_new(data, "framesDelivered", json_integer(framesDelivered.load()));
+	json_object_set_new(data, "channelsMoved", json_integer(channelsMoved.load()));
+	json_object_set_new(data, "missingSourceFrames", json_integer(missingSourceFrames.load()));
+	json_object_set_new(data, "staleReads", json_integer(staleReads.load()));
+	json_object_set_new(data, "labelSwitches", json_integer(labelSwitches.load()));
+	return data;
+}
+
+static json_t* outputStatsToJson(TeleportOutModule *out) {
+	json_t *out_json = out->stats.toJson();
+	json_object_set_new(out_json, "moduleId", json_integer(out->id));
+	const char *mode = out->remote ? "remote" : out->busReturn ? "bus" : out->polyPack ? "pack" : "local";
+	json_object_set_new(out_json, "mode", json_string(mode));
+	return out_json;
+}
+
+json_t* Teleport::diagnosticsToJson() {
+	// Go through all outputs in the engine instead of the subscribers, only
+	// local outputs subscribe. Don't hold writeMutex while calling the
+	// engine, see routingGraphToJson().
+	std::map<std::string, std::vector<TeleportOutModule*>> outsByLabel;
+	std::vector<TeleportOutModule*> matrixOuts;
+	for(int64_t moduleId : APP->engine->getModuleIds()) {
+		TeleportOutModule *out = dynamic_cast<TeleportOutModule*>(APP->engine->getModule(moduleId));
+		if(!out) {
+			continue;
+		}
+		if(out->matrix) {
+			// reads from any number of labels
+			matrixOuts.push_back(out);
+		} else if(!out->label.empty()) {
+			outsByLabel[out->label].push_back(out);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(writeMutex);
+	const TeleportSnapshot *s = getLatestLocked();
+	json_t *links = json_array();
+	for(auto it = labelIds.begin(); it != labelIds.end(); it++) {
+		const int id = it->second;
+		TeleportInModule *source = id < (int) s->sourcesById.size() ? s->sourcesById[id] : NULL;
+		auto outs = outsByLabel.find(it->first);
+		if(!source && outs == outsByLabel.end()) {
+			continue;
+		}
+		json_t *link = json_object();
+		json_object_set_new(link, "label", json_string(it->first.c_str()));
+		if(source) {
+			json_t *source_json = source->stats.toJson();
+			json_object_set_new(source_json, "moduleId", json_integer(source->id));
+			json_object_set_new(link, "source", source_json);
+		} else {
+			json_object_set_new(link, "source", json_null());
+		}
+		json_t *outputs_json = json_array();
+		if(outs != outsByLabel.end()) {
+			for(TeleportOutModule *out : outs->second) {
+				json_array_append_new(outputs_json, outputStatsToJson(out));
+			}
+		}
+		json_object_set_new(link, "outputs", outputs_json);
+		json_array_append_new(links, link);
+	}
+	json_t *matrix_json = json_array();
+	for(TeleportOutModule *out : matrixOuts) {
+		json_t *out_json = outputStatsToJson(out);
+		json_object_set_new(out_json, "mode", json_string("matrix"));
+		json_array_append_new(matrix_json, out_json);
+	}
+	json_t *data = json_object();
+	json_object_set_new(data, "links", links);
+	json_object_set_new(data, "matrixOutputs", matrix_json);
+	return data;
+}
+
+// Find the strongly connected components of a graph (Tarjan's algorithm).
+struct TeleportLoopFinder {
+	std::map<int64_t, std::vector<int64_t>> &edges;
+	std::map<int64_t, int> index, lowlink;
+	std::vector<int64_t> stack;
+	std::set<int64_t> onStack;
+	std::vector<std::vector<int64_t>> loops;
+
+	TeleportLoopFinder(std::map<int64_t, std::vector<int64_t>> &edges) : edges(edges) {}
+
+	void visit(int64_t v) {
+		const int i = index.size();
+		index[v] = i;
+		lowlink[v] = i;
+		stack.push_back(v);
+		onStack.insert(v);
+		for(int64_t w : edges[v]) {
+			if(index.find(w) == index.end()) {
+				visit(w);
+				lowlink[v] = std::min(lowlink[v], lowlink[w]);
+			} else if(onStack.count(w)) {
+				lowlink[v] = std::min(lowlink[v], index[w]);
+			}
+		}
+		if(lowlink[v] != index[v]) {
+			return;
+		}
+		std::vector<int64_t> component;
+		int64_t w;
+		do {
+			w = stack.back();
+			stack.pop_back();
+			onStack.erase(w);
+			component.push_back(w);
+		} while(w != v);
+		const std::vector<int64_t> &e = edges[v];
+		// a single module is only a loop if it's connected to itself
+		if(component.size() > 1 || std::find(e.begin(), e.end(), v) != e.end()) {
+			std::sort(component.begin(), component.end());
+			loops.push_back(component);
+		}
+	}
+};
+
+json_t* Teleport::routingGraphToJson() {
+	// Don't hold writeMutex while calling the engine: the engine holds its
+	// own lock while removing modules, which takes writeMutex.
+	const std::vector<int64_t> moduleIds = APP->engine->getModuleIds();
+	const int threads = APP->engine->getThreadCount();
+	// position of each module in the order the engine processes them
+	std::map<int64_t, int> order;
+	std::vector<TeleportInModule*> ins;
+	std::vector<TeleportOutModule*> outs;
+	for(size_t k = 0; k < moduleIds.size(); k++) {
+		Module *m = APP->engine->getModule(moduleIds[k]);
+		order[moduleIds[k]] = k;
+		if(TeleportInModule *in = dynamic_cast<TeleportInModule*>(m)) {
+			ins.push_back(in);
+		} else if(TeleportOutModule *out = dynamic_cast<TeleportOutModule*>(m)) {
+			outs.push_back(out);
+		}
+	}
+	std::map<int64_t, std::vector<int64_t>> edges;
+	for(int64_t cableId : APP->engine->getCableIds()) {
+		engine::Cable *cable = APP->engine->getCable(cableId);
+		if(cable && cable->outputModule && cable->inputModule) {
+			edges[cable->outputModule->id].push_back(cable->inputModule->id);
+		}
+	}
+
+	json_t *links = json_array();
+	std::set<std::pair<int64_t, int64_t>> teleportEdges;
+	// latency < 0 means that it depends on the order of the engine threads
+	auto addLink = [&](TeleportInModule *source, int sourcePort, TeleportOutModule *out, int port, const char *mode, float latency, bool controlRate) {
+		json_t *link = json_object();
+		json_object_set_new(link, "source", source ? json_integer(source->id) : json_null());
+		json_object_set_new(link, "sourcePort", json_integer(sourcePort + 1));
+		json_object_set_new(link, "target", json_integer(out->id));
+		json_object_set_new(link, "port", json_integer(port + 1));
+		json_object_set_new(link, "mode", json_string(mode));
+		json_object_set_new(link, "latency", latency >= 0.f ? json_real(latency) : json_null());
+		if(controlRate) {
+			// updated every cvDivision samples, so up to that much later
+			json_object_set_new(link, "controlRateDivision", json_integer(out->cvDivision));
+		}
+		json_array_append_new(links, link);
+		if(source) {
+			edges[source->id].push_back(out->id);
+			teleportEdges.insert(std::make_pair(source->id, out->id));
+		}
+	};
+	// Live reads that aren't pushed get the current frame only if the source
+	// has already been processed during it.
+	auto getLiveLatency = [&](TeleportInModule *source, TeleportOutModule *out) {
+		if(threads > 1) {
+			return -1.f;
+		}
+		return order[source->id] < order[out->id] ? 0.f : 1.f;
+	};
+
+	for(TeleportOutModule *out : outs) {
+		if(out->remote) {
+			for(int i = 0; i < out->numPorts; i++) {
+				addLink(NULL, i, out, i, "remote", out->shmLatency, false);
+			}
+		} else if(out->matrix) {
+			for(int i = 0; i < out->numPorts; i++) {
+				TeleportInModule *source = out->routeLabels[i].empty() ? NULL : getSource(out->routeLabels[i]);
+				if(source) {
+					const float latency = out->deterministic ? 1.f : getLiveLatency(source, out);
+					addLink(source, out->getRoutePort(i), out, i, "matrix", latency, false);
+				}
+			}
+		} else if(out->busReturn) {
+			std::vector<TeleportInModule*> senders;
+			for(TeleportInModule *in : ins) {
+				if(!out->label.empty() && in->sendBus == out->label) {
+					senders.push_back(in);
+				}
+			}
+			for(TeleportInModule *sender : senders) {
+				for(int i = 0; i < std::min(out->numPorts.load(), sender->numPorts.load()); i++) {
+					addLink(sender, i, out, i, "bus", 1.f, false);
+				}
+			}
+		} else {
+			TeleportInModule *source = out->label.empty() ? NULL : getSource(out->label);
+			if(!source) {
+				continue;
+			}
+			if(out->polyPack) {
+				// packed ports aren't pushed
+				const float latency = out->deterministic ? 1.f : getLiveLatency(source, out);
+				for(int i = 0; i < std::min(source->numPorts.load(), MAX_POLY_CHANNELS); i++) {
+					addLink(source, i, out, 0, "pack", latency, false);
+				}
+				continue;
+			}
+			for(int i = 0; i < std::min(out->numPorts.load(), source->numPorts.load()); i++) {
+				const float delay = out->delays[i];
+				if(delay > 0.f) {
+					const float latency = out->fractionalDelay ? std::max(delay, 1.f) : std::max(std::round(delay), 1.f);
+					addLink(source, i, out, i, "delayed", latency, out->cvRate[i]);
+				} else if(out->deterministic) {
+					addLink(source, i, out, i, "deterministic", 1.f, out->cvRate[i]);
+				} else if(out->cvRate[i]) {
+					addLink(source, i, out, i, "live", getLiveLatency(source, out), true);
+				} else {
+					// pushed by the source as soon as it has the frame
+					addLink(source, i, out, i, "live", 0.f, false);
+				}
+			}
+		}
+	}
+
+	std::set<int64_t> loopModules;
+	json_t *loops = json_array();
+	TeleportLoopFinder finder(edges);
+	for(int64_t id : moduleIds) {
+		if(finder.index.find(id) == finder.index.end()) {
+			finder.visit(id);
+		}
+	}
+	for(const std::vector<int64_t> &loop : finder.loops) {
+		// only loops closed by a teleport are of interest here
+		bool hasTeleport = false;
+		for(const std::pair<int64_t, int64_t> &e : teleportEdges) {
+			hasTeleport = hasTeleport || (std::binary_search(loop.begin(), loop.end(), e.first) && std::binary_search(loop.begin(), loop.end(), e.second));
+		}
+		if(!hasTeleport) {
+			continue;
+		}
+		json_t *loop_json = json_array();
+		for(int64_t id : loop) {
+			json_array_append_new(loop_json, json_integer(id));
+			loopModules.insert(id);
+		}
+		json_array_append_new(loops, loop_json);
+	}
+
+	json_t *nodes = json_array();
+	for(int64_t id : moduleIds) {
+		Module *m = APP->engine->getModule(id);
+		TeleportInModule *in = dynamic_cast<TeleportInModule*>(m);
+		TeleportOutModule *out = dynamic_cast<TeleportOutModule*>(m);
+		if(!in && !out && !loopModules.count(id)) {
+			continue;
+		}
+		json_t *node = json_object();
+		json_object_set_new(node, "id", json_integer(id));
+		json_object_set_new(node, "kind", json_string(in ? "in" : out ? "out" : "module"));
+		json_object_set_new(node, "name", json_string(m->model ? m->model->name.c_str() : ""));
+		if(in || out) {
+			json_object_set_new(node, "label", json_string(((Teleport*) m)->label.c_str()));
+		}
+		if(in && !in->sendBus.empty()) {
+			json_object_set_new(node, "sendBus", json_string(in->sendBus.c_str()));
+		}
+		json_object_set_new(node, "order", json_integer(order[id]));
+		json_array_append_new(nodes, node);
+	}
+
+	json_t *data = json_object();
+	json_object_set_new(data, "engineThreads", json_integer(threads));
+	json_object_set_new(data, "nodes", nodes);
+	json_object_set_new(data, "links", links);
+	json_object_set_new(data, "loops", loops);
+	return data;
+}
+
+// Labels can contain anything the user typed.
+static std::string escapeDot(std::string text) {
+	std::string escaped;
+	for(char c : text) {
+		if(c == '"' || c == '\\') {
+			escaped += '\\';
+		}
+		escaped += c;
+	}
+	return escaped;
+}
+
+std::string Teleport::routingGraphToDot(json_t *graph) {
+	std::string dot = "digraph teleport {\n\trankdir=LR;\n\tnode [shape=box];\n";
+	std::set<int64_t> loopModules;
+	json_t *loop_json;
+	size_t k;
+	json_array_foreach(json_object_get(graph, "loops"), k, loop_json) {
+		json_t *id_json;
+		size_t j;
+		json_array_foreach(loop_json, j, id_json) {
+			loopModules.insert(json_integer_value(id_json));
+		}
+	}
+
+	json_t *node;
+	json_array_foreach(json_object_get(graph, "nodes"), k, node) {
+		const int64_t id = json_integer_value(json_object_get(node, "id"));
+		std::string text = escapeDot(json_string_value(json_object_get(node, "name")));
+		json_t *label_json = json_object_get(node, "label");
+		if(label_json) {
+			text += "\\n" + escapeDot(json_string_value(label_json));
+		}
+		dot += string::f("\tm%lld [label=\"%s\"%s];\n", (long long) id, text.c_str(), loopModules.count(id) ? ", color=red" : "");
+	}
+
+	// one edge per pair of modules, listing the ports and their latencies
+	std::map<std::pair<int64_t, int64_t>, std::string> edges;
+	json_t *link;
+	json_array_foreach(json_object_get(graph, "links"), k, link) {
+		json_t *source_json = json_object_get(link, "source");
+		if(json_is_null(source_json)) {
+			continue;
+		}
+		const auto key = std::make_pair((int64_t) json_integer_value(source_json), (int64_t) json_integer_value(json_object_get(link, "target")));
+		json_t *latency_json = json_object_get(link, "latency");
+		std::string latency = json_is_null(latency_json) ? "0 or 1" : string::f("%g", json_number_value(latency_json));
+		std::string &text = edges[key];
+		text += string::f("%s%lld>%lld: %s", text.empty() ? "" : "\\n",
+			(long long) json_integer_value(json_object_get(link, "sourcePort")),
+			(long long) json_integer_value(json_object_get(link, "port")), latency.c_str());
+	}
+	for(auto it = edges.begin(); it != edges.end(); it++) {
+		const bool inLoop = loopModules.count(it->first.first) && loopModules.count(it->first.second);
+		dot += string::f("\tm%lld -> m%lld [label=\"%s\", style=dashed%s];\n",
+			(long long) it->first.first, (long long) it->first.second, it->second.c_str(), inLoop ? ", color=red" : "");
+	}
+	dot += "}\n";
+	return dot;
+}
+
+void TeleportInModule::pushToSubscribers(int64_t frame) {
+	const TeleportSnapshot *s = snapshot.load(std::memory_order_acquire);
+	const int id = labelId.load(std::memory_order_relaxed);
+	if(id < 0 || id >= (int) s->subscribersById.size()) {
+		return;
+	}
+	const std::vector<TeleportOutModule*> &subscribers = s->subscribersById[id];
+	for(TeleportOutModule *out : subscribers) {
+		out->receive(this, frame);
+	}
+	stats.increment(stats.framesPushed, subscribers.size());
+}
+
+int Teleport::acquireLabelId(std::string lbl) {
+	std::lock_guard<std::mutex> lock(writeMutex);
+	return acquireLabelIdLocked(lbl);
+}
+
+void Teleport::releaseLabelId(int id) {
+	std::lock_guard<std::mutex> lock(writeMutex);
+	releaseLabelIdLocked(id);
+}
+
+int Teleport::acquireLabelIdLocked(std::string lbl) {
+	int id;
+	auto it = labelIds.find(lbl);
+	if(it != labelIds.end()) {
+		id = it->second;
+	} else if(!freeLabelIds.empty()) {
+		id = freeLabelIds.back();
+		freeLabelIds.pop_back();
+		labelIds[lbl] = id;
+		labelsById[id] = lbl;
+	} else {
+		id = labelsById.size();
+		labelIds[lbl] = id;
+		labelsById.push_back(lbl);
+		labelRefs.push_back(0);
+	}
+	labelRefs[id]++;
+	return id;
+}
+
+void Teleport::releaseLabelIdLocked(int id) {
+	if(id < 0 || --labelRefs[id] > 0) return;
+	labelIds.erase(labelsById[id]);
+	labelsById[id].clear();
+	// An engine thread may have loaded the ID just before it was released,
+	// so it's only reused once that process() call is over.
+	retireLocked([id]() { freeLabelIds.push_back(id); });
+}
+
+bool Teleport::sourceExists(std::string lbl) {
+	return getSource(lbl) != NULL;
+}
+
+TeleportInModule* Teleport::getSource(std::string lbl) {
+	std::lock_guard<std::mutex> lock(writeMutex);
+	const TeleportSnapshot *s = getLatestLocked();
+	auto it = s->sources.find(lbl);
+	return it != s->sources.end() ? it->second : NULL;
+}
+
+TeleportInModule* Teleport::getSourceById(int id) {
+	std::lock_guard<std::mutex> lock(writeMutex);
+	const TeleportSnapshot *s = getLatestLocked();
+	return id >= 0 && id < (int) s->sourcesById.size() ? s->sourcesById[id] : NULL;
+}
+
+std::vector<std::string> Teleport::findSourceLabels(std::string prefix, size_t limit) {
+	std::lock_guard<std::mutex> lock(writeMutex);
+	const TeleportSnapshot *s = getLatestLocked();
+	std::vector<std::string> labels;
+	// the map is sorted, so all matches are right after lower_bound(prefix)
+	for(auto it = s->sources.lower_bound(prefix); it != s->sources.end() && labels.size() < limit; it++) {
+		if(it->first.compare(0, prefix.size(), prefix) != 0) {
+			break;
+		}
+		labels.push_back(it->first);
+	}
+	return labels;
+}
+
+std::vector<std::string> Teleport::findBusLabels() {
+	std::lock_guard<std::mutex> lock(writeMutex);
+	const TeleportSnapshot *s = getLatestLocked();
+	std::vector<std::string> labels;
+	for(auto it = labelIds.begin(); it != labelIds.end(); it++) {
+		if(it->second < (int) s->sendersById.size() && !s->sendersById[it->second].empty()) {
+			labels.push_back(it->first);
+		}
+	}
+	return labels;
+}
+
+void Teleport::addSource(TeleportInModule *t) {
+	std::lock_guard<std::mutex> lock(writeMutex);
+	addSourceLocked(t);
+}
+
+void Teleport::addSourceWithNewLabel(TeleportInModule *t) {
+	std::lock_guard<std::mutex> lock(writeMutex);
+	t->label = labelAllocator.allocate();
+	addSourceLocked(t);
+}
+
+void Teleport::addSourceLocked(TeleportInModule *t) {
+	std::string key = t->label;
+	int id = acquireLabelIdLocked(key);
+	TeleportSnapshot *s = editSnapshotLocked();
+	s->sources[key] = t;
+	if(id >= (int) s->sourcesById.size()) {
+		s->sourcesById.resize(id + 1, NULL);
+	}
+	s->sourcesById[id] = t;
+	t->labelId.store(id);
+	labelAllocator.setTaken(key, true);
+	commitSnapshotLocked(false);
+	lastInsertedKey = key;
+}
+
+void Teleport::removeSource(TeleportInModule *t) {
+	// not registered, e.g. already removed before being retired
+	if(t->labelId.load() < 0) return;
+	std::lock_guard<std::mutex> lock(writeMutex);
+	const int id = t->labelId.load();
+	const TeleportSnapshot *published = snapshot.load();
+	const bool wasPublished = id < (int) published->sourcesById.size() && published->sourcesById[id] == t;
+	const TeleportSnapshot *latest = getLatestLocked();
+	auto it = latest->sources.find(t->label);
+	if(it != latest->sources.end() && it->second == t) {
+		TeleportSnapshot *s = editSnapshotLocked();
+		s->sources.erase(t->label);
+		s->sourcesById[id] = NULL;
+		labelAllocator.setTaken(t->label, false);
+	}
+	t->labelId.store(-1);
+	releaseLabelIdLocked(id);
+	commitSnapshotLocked(wasPublished);
+}
 
-		addSource(this);
+void Teleport::addPasteRename(std::string from, std::string to) {
+	pasteRenames[from] = to;
+	// outputs pasted before the source
+	for(TeleportOutModule *out : pastedOutputs) {
+		if(out->label == from) {
+			out->setLabel(to);
+		}
+		out->renameRoutes(from, to);
+	}
+}
 
+std::string Teleport::getPastedLabel(std::string lbl, TeleportOutModule *t) {
+	if(std::find(pastedOutputs.begin(), pastedOutputs.end(), t) == pastedOutputs.end()) {
+		pastedOutputs.push_back(t);
 	}
+	auto it = pasteRenames.find(lbl);
+	return it != pasteRenames.end() ? it->second : lbl;
+}
 
-};
+void Teleport::beginPaste() {
+	pasting = true;
+	if(!APP || !APP->scene) return;
+	std::lock_guard<std::mutex> lock(writeMutex);
+	batching = true;
+}
 
-struct TeleportOutModule : Teleport {
+void Teleport::endPaste() {
+	pasting = false;
+	pasteRenames.clear();
+	pastedOutputs.clear();
+	std::lock_guard<std::mutex> lock(writeMutex);
+	batching = false;
+	commitSnapshotLocked(true);
+}
 
-	bool sourceIsValid;
+// Whether t is listed under id in table.
+template <typename T>
+static bool isListed(const std::vector<std::vector<T*>> &table, int id, T *t) {
+	if(id >= (int) table.size()) {
+		return false;
+	}
+	const std::vector<T*> &v = table[id];
+	return std::find(v.begin(), v.end(), t) != v.end();
+}
 
-	enum ParamIds {
-		NUM_PARAMS
-	};
-	enum InputIds {
-		NUM_INPUTS
-	};
-	enum OutputIds {
-		OUTPUT_1,
-		OUTPUT_2,
-		OUTPUT_3,
-		OUTPUT_4,
-		OUTPUT_5,
-		OUTPUT_6,
-		OUTPUT_7,
-		OUTPUT_8,
-		NUM_OUTPUTS
-	};
-	enum LightIds {
-		OUTPUT_1_LIGHTG,
-		OUTPUT_1_LIGHTR,
-		OUTPUT_2_LIGHTG,
-		OUTPUT_2_LIGHTR,
-		OUTPUT_3_LIGHTG,
-		OUTPUT_3_LIGHTR,
-		OUTPUT_4_LIGHTG,
-		OUTPUT_4_LIGHTR,
-		OUTPUT_5_LIGHTG,
-		OUTPUT_5_LIGHTR,
-		OUTPUT_6_LIGHTG,
-		OUTPUT_6_LIGHTR,
-		OUTPUT_7_LIGHTG,
-		OUTPUT_7_LIGHTR,
-		OUTPUT_8_LIGHTG,
-		OUTPUT_8_LIGHTR,
+void Teleport::subscribe(TeleportOutModule *t, int id) {
+	if(id < 0) return;
+	std::lock_guard<std::mutex> lock(writeMutex);
+	TeleportSnapshot *s = editSnapshotLocked();
+	if(id >= (int) s->subscribersById.size()) {
+		s->subscribersById.resize(id + 1);
+	}
+	s->subscribersById[id].push_back(t);
+	commitSnapshotLocked(false);
+}
 
-		NUM_LIGHTS
-	};
+void Teleport::unsubscribe(TeleportOutModule *t, int id) {
+	if(id < 0) return;
+	std::lock_guard<std::mutex> lock(writeMutex);
+	if(!isListed(getLatestLocked()->subscribersById, id, t)) {
+		return;
+	}
+	const bool wasPublished = isListed(snapshot.load()->subscribersById, id, t);
+	TeleportSnapshot *s = editSnapshotLocked();
+	std::vector<TeleportOutModule*> &v = s->subscribersById[id];
+	v.erase(std::remove(v.begin(), v.end(), t), v.end());
+	commitSnapshotLocked(wasPublished);
+}
 
-	TeleportOutModule() : Teleport(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS) {
-		assert(NUM_OUTPUTS == NUM_TELEPORT_INPUTS);
-		for(int i = 0; i < NUM_TELEPORT_INPUTS; i++) {
-			configOutput(i, string::f("Port %d", i + 1));
-		}
-		if(sources.size() > 0) {
-			if(sourceExists(lastInsertedKey)) {
-				label = lastInsertedKey;
-			} else {
-				// the lastly added input doesn't exist anymore,
-				// pick first input in alphabetical order
-				label = sources.begin()->first;
-			}
-			sourceIsValid = true;
-		} else {
-			label = "";
-			sourceIsValid = false;
-		}
+void Teleport::addSender(TeleportInModule *t) {
+	if(t->sendBus.empty()) return;
+	std::lock_guard<std::mutex> lock(writeMutex);
+	const int id = acquireLabelIdLocked(t->sendBus);
+	TeleportSnapshot *s = editSnapshotLocked();
+	if(id >= (int) s->sendersById.size()) {
+		s->sendersById.resize(id + 1);
 	}
+	std::vector<TeleportInModule*> &v = s->sendersById[id];
+	auto pos = std::upper_bound(v.begin(), v.end(), t,
+		[](TeleportInModule *a, TeleportInModule *b) { return a->id < b->id; });
+	v.insert(pos, t);
+	t->sendBusId = id;
+	commitSnapshotLocked(false);
+}
 
-	void process(const ProcessArgs &args) override {
+void Teleport::removeSender(TeleportInModule *t) {
+	const int id = t->sendBusId;
+	if(id < 0) return;
+	std::lock_guard<std::mutex> lock(writeMutex);
+	const bool wasPublished = isListed(snapshot.load()->sendersById, id, t);
+	TeleportSnapshot *s = editSnapshotLocked();
+	std::vector<TeleportInModule*> &v = s->sendersById[id];
+	v.erase(std::remove(v.begin(), v.end(), t), v.end());
+	t->sendBusId = -1;
+	releaseLabelIdLocked(id);
+	commitSnapshotLocked(wasPublished);
+}
 
-		if(sourceExists(label)){
-			TeleportInModule *src = sources[label];
-			for(int i = 0; i < NUM_TELEPORT_INPUTS; i++) {
-				Input input = src->inputs[TeleportInModule::INPUT_1 + i];
-				const int channels = input.getChannels();
-				outputs[OUTPUT_1 + i].setChannels(channels);
-				for(int c = 0; c < channels; c++) {
-					outputs[OUTPUT_1 + i].setVoltage(input.getVoltage(c), c);
-				}
-				lights[OUTPUT_1_LIGHTG + 2*i].setBrightness( input.isConnected());
-				lights[OUTPUT_1_LIGHTR + 2*i].setBrightness(!input.isConnected());
-			}
-			sourceIsValid = true;
-		} else {
-			for(int i = 0; i < NUM_TELEPORT_INPUTS; i++) {
-				outputs[i].setChannels(1);
-				outputs[OUTPUT_1 + i].setVoltage(0.f);
-				lights[OUTPUT_1_LIGHTG + 2*i].setBrightness(0.f);
-				lights[OUTPUT_1_LIGHTR + 2*i].setBrightness(0.f);
-			}
-			sourceIsValid = false;
+void Teleport::changeHistoryReaders(const std::vector<int> &from, const std::vector<int> &to) {
+	if(from.empty() && to.empty()) return;
+	std::lock_guard<std::mutex> lock(writeMutex);
+	TeleportSnapshot *s = editSnapshotLocked();
+	for(int id : to) {
+		if(id >= (int) s->historyReadersById.size()) {
+			s->historyReadersById.resize(id + 1, 0);
 		}
-	};
+		s->historyReadersById[id]++;
+	}
+	for(int id : from) {
+		s->historyReadersById[id]--;
+	}
+	commitSnapshotLocked(false);
+}
 
-	json_t* dataToJson() override {
-		json_t *data = json_object();
-		json_object_set_new(data, "label", json_string(label.c_str()));
-		return data;
+const TeleportSnapshot* Teleport::getLatestLocked() {
+	return draft ? draft : snapshot.load();
+}
+
+TeleportSnapshot* Teleport::editSnapshotLocked() {
+	if(!draft) {
+		draft = new TeleportSnapshot(*snapshot.load());
 	}
+	return draft;
+}
 
-	void dataFromJson(json_t* root) override {
-		json_t *label_json = json_object_get(root, "label");
-		if(json_is_string(label_json)) {
-			label = json_string_value(label_json);
-		}
+void Teleport::commitSnapshotLocked(bool now) {
+	if(!draft || (batching && !now)) {
+		return;
 	}
-};
+	publishSnapshot(draft);
+	draft = NULL;
+}
 
-void Teleport::addSource(TeleportInModule *t) {
-	std::string key = t->label;
-	sources[key] = t; //TODO: mutex?
-	lastInsertedKey = key;
+void Teleport::publishSnapshot(TeleportSnapshot *s) {
+	const TeleportSnapshot *old = snapshot.load();
+	s->version = old->version + 1;
+	snapshot.store(s, std::memory_order_release);
+	sourcesVersion.store(s->version, std::memory_order_release);
+	retireLocked([old]() { delete old; });
+}
+
+void Teleport::retireLocked(std::function<void()> deleter) {
+	const int64_t frame = getEngineFrame();
+	retired.push_back(std::make_pair(deleter, frame));
+	collectRetired();
+}
+
+void Teleport::collectRetired() {
+	// Without an engine nobody can be reading the objects, otherwise wait
+	// until the frame during which the object was retired has finished.
+	const int64_t frame = getEngineFrame();
+	auto it = std::remove_if(retired.begin(), retired.end(),
+		[frame](const std::pair<std::function<void()>, int64_t>& r) {
+			if(frame < 0 || r.second < 0 || frame >= r.second + 2) {
+				r.first();
+				return true;
+			}
+			return false;
+		});
+	retired.erase(it, retired.end());
 }
 
 
@@ -255,16 +2240,167 @@ struct TeleportLabelMenuItem : MenuItem {
 	TeleportOutModule *module;
 	std::string label;
 	void onAction(const event::Action &e) override {
-		module->label = label;
+		if(label != module->label) {
+			module->stats.increment(module->stats.labelSwitches);
+		}
+		module->setLabel(label);
+	}
+};
+
+// Text field in a context menu, based on ParamField in src/app/ParamWidget.cpp.
+// Pressing enter calls action with the text and closes the menu.
+struct TeleportValueField : ui::TextField {
+	std::function<void(std::string)> action;
+
+	void step() override {
+		// keep the field focused while the menu is open
+		APP->event->setSelectedWidget(this);
+		TextField::step();
+	}
+
+	void onSelectKey(const event::SelectKey &e) override {
+		if(e.action == GLFW_PRESS && (e.key == GLFW_KEY_ENTER || e.key == GLFW_KEY_KP_ENTER)) {
+			if(action) {
+				action(text);
+			}
+			ui::MenuOverlay *overlay = getAncestorOfType<ui::MenuOverlay>();
+			if(overlay) {
+				overlay->requestDelete();
+			}
+			e.consume(this);
+		}
+		if(!e.getTarget()) {
+			TextField::onSelectKey(e);
+		}
+	}
+};
+
+// Text field at the top of the source selector menu. Typing filters the menu
+// down to the labels starting with the text, and enter selects the first one.
+// Only the first few matches are turned into menu items, so that the menu stays
+// fast and usable with thousands of sources.
+struct TeleportSourceSearchField : TeleportValueField {
+	TeleportOutModule *module;
+	ui::Menu *menu;
+	std::vector<Widget*> items; // the items below the field, replaced when the text changes
+	std::string firstMatch;
+	static const size_t maxItems = 32;
+
+	TeleportSourceSearchField() {
+		action = [this](std::string text) {
+			if(!firstMatch.empty()) {
+				module->setLabel(firstMatch);
+			} else if(module->remote && !text.empty()) {
+				// shared labels can't be listed on every platform, see
+				// getSharedTeleportLabels()
+				module->setLabel(text);
+			}
+		};
+	}
+
+	void onChange(const event::Change &e) override {
+		updateItems();
+	}
+
+	void addItem(Widget *item) {
+		menu->addChild(item);
+		items.push_back(item);
+	}
+
+	void updateItems() {
+		for(Widget *item : items) {
+			menu->removeChild(item);
+			delete item;
+		}
+		items.clear();
+
+		// one more than we show, to find out whether there are more
+		std::vector<std::string> labels;
+		if(module->remote) {
+			for(const std::string& lbl : getSharedTeleportLabels()) {
+				if(lbl.compare(0, text.size(), text) == 0 && labels.size() <= maxItems) {
+					labels.push_back(lbl);
+				}
+			}
+		} else {
+			labels = Teleport::findSourceLabels(text, maxItems + 1);
+		}
+		firstMatch = labels.empty() ? "" : labels[0];
+
+		for(size_t i = 0; i < labels.size() && i < maxItems; i++) {
+			TeleportLabelMenuItem *item = new TeleportLabelMenuItem();
+			item->module = module;
+			item->label = labels[i];
+			item->text = labels[i];
+			item->rightText = CHECKMARK(item->label == module->label);
+			addItem(item);
+		}
+		if(labels.size() > maxItems) {
+			addItem(createMenuLabel("More sources, type to narrow down"));
+		} else if(labels.empty() && module->remote) {
+			addItem(createMenuLabel(text.empty() ? "Type a shared label" : "Press enter to receive from " + text));
+		} else if(labels.empty()) {
+			addItem(createMenuLabel("No matching sources"));
+		}
 	}
 };
 
+// One submenu per output for picking the source and port it is routed from.
+void appendTeleportRoutingMenu(Menu *menu, TeleportOutModule *module) {
+	for(int i = 0; i < module->numPorts; i++) {
+		std::string routeText = module->routeLabels[i].empty() ? "" : string::f("%s:%d", module->routeLabels[i].c_str(), module->getRoutePort(i) + 1);
+		menu->addChild(createSubmenuItem(string::f("Port %d", i + 1), routeText, [=](Menu *menu) {
+			menu->addChild(createCheckMenuItem("(none)", "",
+				[=]() { return module->routeLabels[i].empty(); },
+				[=]() { module->setRoute(i, "", 0); }));
+			std::vector<std::string> labels = Teleport::findSourceLabels("", 256);
+			if(!module->routeLabels[i].empty() && !Teleport::sourceExists(module->routeLabels[i])) {
+				labels.insert(labels.begin(), module->routeLabels[i]);
+			}
+			for(std::string lbl : labels) {
+				menu->addChild(createSubmenuItem(lbl, CHECKMARK(module->routeLabels[i] == lbl), [=](Menu *menu) {
+					TeleportInModule *source = Teleport::getSource(lbl);
+					const int n = source ? source->numPorts.load() : NUM_TELEPORT_INPUTS;
+					for(int p = 0; p < n; p++) {
+						menu->addChild(createCheckMenuItem(string::f("Port %d", p + 1), "",
+							[=]() { return module->routeLabels[i] == lbl && module->getRoutePort(i) == p; },
+							[=]() { module->setRoute(i, lbl, p); }));
+					}
+				}));
+			}
+		}));
+	}
+}
+
 struct TeleportSourceSelectorTextBox : HoverableTextBox, TeleportLabelDisplay {
 	TeleportOutModule *module;
 
 	TeleportSourceSelectorTextBox() : HoverableTextBox() {}
 
 	void onAction(const event::Action &e) override {
+		if(module->matrix) {
+			Menu *menu = createMenu();
+			menu->addChild(createMenuLabel("Route outputs"));
+			appendTeleportRoutingMenu(menu, module);
+			return;
+		}
+		if(module->busReturn) {
+			Menu *menu = createMenu();
+			menu->addChild(createMenuLabel("Select send bus"));
+			std::vector<std::string> labels = Teleport::findBusLabels();
+			if(!module->label.empty() && std::find(labels.begin(), labels.end(), module->label) == labels.end()) {
+				labels.insert(labels.begin(), module->label);
+			}
+			for(std::string lbl : labels) {
+				TeleportLabelMenuItem *item = new TeleportLabelMenuItem();
+				item->module = module;
+				item->label = lbl;
+				item->text = lbl;
+				item->rightText = CHECKMARK(module->label == lbl);
+				menu->addChild(item);
+			}
+			return;
+		}
 		// based on AudioDeviceChoice::onAction in src/app/AudioWidget.cpp
 		Menu *menu = createMenu();
 		menu->addChild(construct<MenuLabel>(&MenuLabel::text, "Select source"));
@@ -289,15 +2425,13 @@ struct TeleportSourceSelectorTextBox : HoverableTextBox, TeleportLabelDisplay {
 			menu->addChild(item);
 		}
 
-		auto src = module->sources;
-		for(auto it = src.begin(); it != src.end(); it++) {
-			TeleportLabelMenuItem *item = new TeleportLabelMenuItem();
-			item->module = module;
-			item->label = it->first;
-			item->text = it->first;
-			item->rightText = CHECKMARK(item->label == module->label);
-			menu->addChild(item);
-		}
+		TeleportSourceSearchField *field = new TeleportSourceSearchField();
+		field->module = module;
+		field->menu = menu;
+		field->box.size.x = 100.f;
+		field->placeholder = "Search";
+		menu->addChild(field);
+		field->updateItems();
 	}
 
 	void onButton(const event::Button &e) override {
@@ -314,7 +2448,7 @@ struct TeleportSourceSelectorTextBox : HoverableTextBox, TeleportLabelDisplay {
 	void step() override {
 		HoverableTextBox::step();
 		if(!module) return;
-		setText(module->label);
+		setText(module->matrix ? "MTX" : module->label);
 		textColor = module->sourceIsValid ? defaultTextColor : errorTextColor;
 	}
 
@@ -392,105 +2526,120 @@ struct TeleportOutPortWidget : PJ301MPort {
 
 };
 
+void TeleportOutPortTooltip::updateCableText(const std::vector<CableWidget*> &outgoing, CableWidget *incoming) {
+	cableText = "";
+	teleportText = "";
+	for(CableWidget *cw : outgoing) {
+		// we know that the portWidget is always an output, so otherPw will be the cable input port.
+		PortWidget* otherPw = cw->inputPort;
+		if(!otherPw)
+			continue;
+
+		cableText += "\n";
+		// This widget is always instantiated on an output, so always say "To"
+		cableText += "To ";
+		cableText += otherPw->module->model->getFullName();
+		cableText += ": ";
+		cableText += otherPw->getPortInfo()->getName();
+		cableText += " ";
+		cableText += "input";
+	}
+	if(incoming) {
+		// cable is incoming to the other end of the corresponding
+		// teleport input, snag the label from it
+		teleportText += "\n";
+		teleportText += "Teleporting from ";
+		teleportText += incoming->outputPort->module->model->getFullName();
+		teleportText += ": ";
+		teleportText += incoming->outputPort->getPortInfo()->getName();
+		teleportText += " ";
+		teleportText += "output";
+	}
+}
+
+// Return whether the voltages have changed since the last call.
+bool TeleportOutPortTooltip::updateVoltageText() {
+	engine::Port* port = portWidget->getPort();
+	int channels = port->getChannels();
+	const float* voltages = port->getVoltages();
+	if(channels == lastChannels && std::equal(voltages, voltages + channels, lastVoltages)) {
+		return false;
+	}
+	lastChannels = channels;
+	std::copy(voltages, voltages + channels, lastVoltages);
+
+	// Get voltage text based on the number of channels
+	voltageText = "";
+	for (int i = 0; i < channels; i++) {
+		float v = voltages[i];
+		// Add newline or comma
+		voltageText += "\n";
+		if (channels > 1)
+			voltageText += string::f("%d: ", i + 1);
+		voltageText += string::f("% .3fV", math::normalizeZero(v));
+	}
+	return true;
+}
+
 void TeleportOutPortTooltip::step() {
 	// Based on PortTooltip::step(), but reworked to display also the label of
 	// the incoming signal at the other end of the teleport if applicable.
 	if (portWidget->module) {
 
-		// The final tooltip text is going to have these four parts.
-		std::string labelText = "";
-		std::string description = ""; // Note: TeleportOutPortWidget doesn't actually have a description, but this is here for completeness anyway.
-		std::string voltageText = "";
-		std::string cableText = "";
-
-		// find out the corresponding teleport input
+		// find out the corresponding teleport input, by label ID like
+		// process() does
 		TeleportOutModule* mod = dynamic_cast<TeleportOutModule*>(portWidget->module);
-		TeleportInModule* inputTeleport = NULL;
-		if(mod && mod->sourceExists(mod->label)) {
-			inputTeleport = mod->sources[mod->label];
+		int id = -1;
+		int inputPortId = portWidget->portId;
+		if(mod && mod->matrix) {
+			const int i = portWidget->portId - TeleportOutModule::OUTPUT_1;
+			id = mod->getRouteId(i);
+			inputPortId = TeleportInModule::INPUT_1 + std::max(mod->getRoutePort(i), 0);
+		} else if(mod) {
+			id = mod->labelId.load();
 		}
-
-		engine::Port* port = portWidget->getPort();
-		engine::PortInfo* portInfo = portWidget->getPortInfo();
-
-		description = portInfo->getDescription();
-
-		// Get voltage text based on the number of channels
-		int channels = port->getChannels();
-		for (int i = 0; i < channels; i++) {
-			float v = port->getVoltage(i);
-			// Add newline or comma
-			voltageText += "\n";
-			if (channels > 1)
-				voltageText += string::f("%d: ", i + 1);
-			voltageText += string::f("% .3fV", math::normalizeZero(v));
+		TeleportInModule* inputTeleport = Teleport::getSourceById(id);
+
+		// the cables going out of this port, and the one into the source port
+		std::vector<CableWidget*> outgoing = APP->scene->rack->getCompleteCablesOnPort(portWidget);
+		CableWidget* incoming = NULL;
+		ModuleWidget* sourceWidget = inputTeleport ? APP->scene->rack->getModule(inputTeleport->id) : NULL;
+		if(sourceWidget) {
+			incoming = APP->scene->rack->getTopCable(sourceWidget->getInput(inputPortId));
+			if(incoming && !incoming->isComplete())
+				incoming = NULL;
+		}
+		std::vector<int64_t> ids;
+		for(CableWidget* cw : outgoing) {
+			ids.push_back(cw->cable->id);
+		}
+		ids.push_back(incoming ? incoming->cable->id : -1);
+
+		bool changed = updateVoltageText();
+		if(inputTeleport != source || inputPortId != sourcePortId || ids != cableIds) {
+			source = inputTeleport;
+			sourcePortId = inputPortId;
+			cableIds = ids;
+			updateCableText(outgoing, incoming);
+			changed = true;
 		}
 
-		labelText = portInfo->getFullName();
-
-		// Find the relevant cables: the cable going out of this port and the
-		// cable of the corresponding port on the other end of the teleport. We
-		// iterate over all cables, but that's fine, getCompleteCablesOnPort
-		// would do that anyway.
-		for (widget::Widget* w : APP->scene->rack->getCableContainer()->children) {
-			CableWidget* cw = dynamic_cast<CableWidget*>(w);
-
-			if(!cw->isComplete())
-				continue;
-
-			if(cw->outputPort == portWidget) {
-				// we've found a cable that is outgoing from this port
-				// we know that the portWidget is always an output, so otherPw will be the cable input port.
-				PortWidget* otherPw = cw->inputPort;
-				if(!otherPw)
-					continue;
+		if(changed) {
+			engine::PortInfo* portInfo = portWidget->getPortInfo();
+			// Note: TeleportOutPortWidget doesn't actually have a description, but this is here for completeness anyway.
+			std::string description = portInfo->getDescription();
 
-				cableText += "\n";
-				// This widget is always instantiated on an output, so always say "To"
-				cableText += "To ";
-				cableText += otherPw->module->model->getFullName();
-				cableText += ": ";
-				cableText += otherPw->getPortInfo()->getName();
-				cableText += " ";
-				cableText += "input";
-
-			} else if(inputTeleport
-			   && cw->inputPort
-			   && cw->outputPort
-			   && cw->inputPort->module == inputTeleport
-			   && cw->inputPort->portId == portWidget->portId
-			  ) {
-				// cable is incoming to the other end of the corresponding
-				// teleport input, snag the label from it
-				labelText += "\n";
-				labelText += "Teleporting from ";
-				labelText += cw->outputPort->module->model->getFullName();
-				labelText += ": ";
-				labelText += cw->outputPort->getPortInfo()->getName();
-				labelText += " ";
-				labelText += "output";
+			// Assemble the final tooltip text.
+			text = portInfo->getFullName();
+			// teleportText and the others already start with newline
+			text += teleportText;
 
-			} else {
-				continue;
+			if(description != "") {
+				text += "\n";
+				text += description;
 			}
 
-		}
-
-		// Assemble the final tooltip text.
-		text = labelText;
-
-		if(description != "") {
-			text += "\n";
-			text += description;
-		}
-
-		if(voltageText != "") {
-			// voltageText already starts with newline
 			text += voltageText;
-		}
-
-		if(cableText != "") {
-			// cableText already starts with newline
 			text += cableText;
 		}
 
@@ -510,9 +2659,103 @@ void TeleportOutPortTooltip::step() {
 // module widgets //
 ////////////////////
 
+// Same as createBoolPtrMenuItem() and createIndexPtrSubmenuItem(), for the
+// settings that process() reads, which are atomics.
+static ui::MenuItem* createAtomicBoolMenuItem(std::string text, std::atomic<bool> *ptr) {
+	return createBoolMenuItem(text, "",
+		[=]() { return ptr->load(); },
+		[=](bool value) { ptr->store(value); });
+}
+
+static ui::MenuItem* createAtomicIndexSubmenuItem(std::string text, std::vector<std::string> labels, std::atomic<int> *ptr) {
+	return createIndexSubmenuItem(text, labels,
+		[=]() { return (size_t) ptr->load(); },
+		[=](size_t i) { ptr->store(i); });
+}
+
+// Measures how fast a counter grows, for the diagnostics in the context menus.
+struct TeleportRateMeter {
+	uint64_t lastCount = 0;
+	std::chrono::steady_clock::time_point lastTime = std::chrono::steady_clock::now();
+	float rate = 0.f; // per second
+
+	void update(uint64_t count) {
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		float dt = std::chrono::duration<float>(now - lastTime).count();
+		if(dt < 1.f) {
+			return;
+		}
+		rate = (count - lastCount) / dt;
+		lastCount = count;
+		lastTime = now;
+	}
+};
+
+static void copyJsonToClipboard(json_t *data) {
+	char *text = json_dumps(data, JSON_INDENT(2));
+	if(text) {
+		glfwSetClipboardString(APP->window->win, text);
+		std::free(text);
+	}
+	json_decref(data);
+}
+
+// The items shared by the diagnostics submenus of inputs and outputs.
+void appendTeleportDiagnosticsItems(Menu *menu) {
+	menu->addChild(createMenuItem("Copy diagnostics of all teleports as JSON", "", []() {
+		copyJsonToClipboard(Teleport::diagnosticsToJson());
+	}));
+	menu->addChild(createMenuItem("Copy routing graph as JSON", "", []() {
+		copyJsonToClipboard(Teleport::routingGraphToJson());
+	}));
+	menu->addChild(createMenuItem("Save routing graph as DOT...", "", []() {
+		osdialog_filters *filters = osdialog_filters_parse("Graphviz:dot,gv");
+		char *path = osdialog_file(OSDIALOG_SAVE, NULL, "teleports.dot", filters);
+		osdialog_filters_free(filters);
+		if(!path) {
+			return;
+		}
+		json_t *graph = Teleport::routingGraphToJson();
+		std::string dot = Teleport::routingGraphToDot(graph);
+		json_decref(graph);
+		FILE *file = std::fopen(path, "w");
+		if(file) {
+			std::fputs(dot.c_str(), file);
+			std::fclose(file);
+		}
+		std::free(path);
+	}));
+}
+
+// The background of the port columns beyond the first one, which is covered
+// by the panel SVG.
+struct TeleportPanelExtension : Widget {
+	void draw(const DrawArgs &args) override {
+		nvgBeginPath(args.vg);
+		nvgRect(args.vg, 0, 0, box.size.x, box.size.y);
+		nvgFillColor(args.vg, nvgRGB(0xfa, 0xfa, 0xfa));
+		nvgFill(args.vg);
+		nvgStrokeColor(args.vg, nvgRGB(0xc8, 0xc8, 0xc8));
+		nvgStrokeWidth(args.vg, 1.f);
+		for(float x = 0.f; x < box.size.x; x += 45.f) {
+			nvgBeginPath(args.vg);
+			nvgMoveTo(args.vg, x + 0.5f, RACK_GRID_WIDTH);
+			nvgLineTo(args.vg, x + 0.5f, box.size.y - RACK_GRID_WIDTH);
+			nvgStroke(args.vg);
+		}
+	}
+};
+
 struct TeleportModuleWidget : ModuleWidget {
 	HoverableTextBox *labelDisplay;
 	Teleport *module;
+	// All TELEPORT_MAX_PORTS ports and their lights (if any), in columns of
+	// NUM_TELEPORT_INPUTS. Only the ones in use are shown.
+	std::vector<PortWidget*> portWidgets;
+	std::vector<Widget*> portLights;
+	TeleportPanelExtension *panelExtension;
+	float panelWidth;
+	int shownPorts = -1;
 
 	virtual void addLabelDisplay(HoverableTextBox *disp) {
 		disp->font_size = 14;
@@ -527,24 +2770,214 @@ struct TeleportModuleWidget : ModuleWidget {
 		return 57.f + 37.f * i;
 	}
 
+	Vec getPortPos(int i) {
+		return Vec(22.5f + 45.f * (i / NUM_TELEPORT_INPUTS), getPortYCoord(i % NUM_TELEPORT_INPUTS));
+	}
+
+	// Show the ports in use and resize the panel to fit them. The cables of
+	// ports that are no longer in use have been removed by changeNumPorts().
+	void updatePorts() {
+		const int n = module ? module->numPorts.load() : NUM_TELEPORT_INPUTS;
+		for(int i = 0; i < (int) portWidgets.size(); i++) {
+			const bool used = i < n;
+			portWidgets[i]->visible = used;
+			if(portLights[i]) {
+				portLights[i]->visible = used;
+			}
+		}
+		const int columns = (n + NUM_TELEPORT_INPUTS - 1) / NUM_TELEPORT_INPUTS;
+		const float width = panelWidth * columns;
+		const bool grew = width > box.size.x;
+		box.size.x = width;
+		panelExtension->box.size.x = width - panelWidth;
+		panelExtension->visible = columns > 1;
+		// nothing to push around before we're in the rack
+		if(grew && module && parent) {
+			// push the modules on the right out of the way
+			APP->scene->rack->setModulePosForce(this, box.pos);
+		}
+		shownPorts = n;
+	}
+
 	TeleportModuleWidget(Teleport *module, std::string panelFilename) {
 		setModule(module);
 		this->module = module;
 		setPanel(APP->window->loadSvg(asset::plugin(pluginInstance, panelFilename)));
+		panelWidth = box.size.x;
+		panelExtension = new TeleportPanelExtension();
+		panelExtension->box.pos = Vec(panelWidth, 0);
+		panelExtension->box.size = Vec(0, box.size.y);
+		panelExtension->visible = false;
+		addChild(panelExtension);
 
 		addChild(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, 0)));
 		addChild(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
 
 	}
+
+	void step() override {
+		const int n = module ? module->numPorts.load() : NUM_TELEPORT_INPUTS;
+		if(n != shownPorts) {
+			updatePorts();
+		}
+		ModuleWidget::step();
+		// any paste has been completed by now
+		if(Teleport::pasting) {
+			Teleport::endPaste();
+		}
+	}
+
+	void appendPortCountMenu(ui::Menu *menu, std::function<void(int)> setNumPorts) {
+		static const std::vector<int> counts = {8, 16, 32, 64};
+		std::vector<std::string> countLabels;
+		for(int c : counts) {
+			countLabels.push_back(string::f("%d", c));
+		}
+		Teleport *module = this->module;
+		menu->addChild(createIndexSubmenuItem("Ports", countLabels,
+			[=]() {
+				auto it = std::find(counts.begin(), counts.end(), module->numPorts);
+				return it != counts.end() ? it - counts.begin() : -1;
+			},
+			[=](size_t i) { changeNumPorts(counts[i], setNumPorts); }));
+	}
+
+	// Change the number of ports as one undoable action, together with
+	// removing the cables of the ports that go away.
+	void changeNumPorts(int n, std::function<void(int)> setNumPorts) {
+		history::ComplexAction *complexAction = new history::ComplexAction();
+		complexAction->name = "change teleport ports";
+		for(int i = n; i < (int) portWidgets.size(); i++) {
+			for(CableWidget *cw : APP->scene->rack->getCompleteCablesOnPort(portWidgets[i])) {
+				history::CableRemove *h = new history::CableRemove();
+				h->setCable(cw);
+				complexAction->push(h);
+				APP->scene->rack->removeCable(cw);
+				delete cw;
+			}
+		}
+		history::ModuleChange *h = new history::ModuleChange();
+		h->moduleId = module->id;
+		h->oldModuleJ = toJson();
+		setNumPorts(n);
+		h->newModuleJ = toJson();
+		complexAction->push(h);
+		APP->history->push(complexAction);
+	}
 };
 
 
 struct TeleportInModuleWidget : TeleportModuleWidget {
+	TeleportInModule *inModule;
 
 	TeleportInModuleWidget(TeleportInModule *module) : TeleportModuleWidget(module, "res/TeleportIn.svg") {
+		inModule = module;
 		addLabelDisplay(new EditableTeleportLabelTextbox(module));
-		for(int i = 0; i < NUM_TELEPORT_INPUTS; i++) {
-			addInput(createInputCentered<PJ301MPort>(Vec(22.5, getPortYCoord(i)), module, TeleportInModule::INPUT_1 + i));
+		for(int i = 0; i < TELEPORT_MAX_PORTS; i++) {
+			PortWidget *port = createInputCentered<PJ301MPort>(getPortPos(i), module, TeleportInModule::INPUT_1 + i);
+			addInput(port);
+			portWidgets.push_back(port);
+			portLights.push_back(NULL);
+		}
+		updatePorts();
+	}
+
+	TeleportRateMeter publishRate;
+
+	void step() override {
+		TeleportModuleWidget::step();
+		if(inModule) {
+			// grow the history if an output has asked for a longer delay
+			inModule->maintainHistory();
+			publishRate.update(inModule->stats.framesPublished.load(std::memory_order_relaxed));
+		}
+	}
+
+	void appendContextMenu(ui::Menu* menu) override {
+		TeleportInModule *module = inModule;
+		menu->addChild(new MenuLabel());
+		menu->addChild(createBoolMenuItem("Share with other Rack instances", "",
+			[=]() { return module->shared; },
+			[=](bool shared) {
+				module->shared = shared;
+				module->updateSharing();
+			}));
+		if(module->shareFailed) {
+			menu->addChild(createMenuLabel("Label is already shared by another instance"));
+		}
+		appendPortCountMenu(menu, [=](int n) { module->setNumPorts(n); });
+		menu->addChild(createAtomicBoolMenuItem("Unpack polyphonic port 1 to ports", &module->polyUnpack));
+		menu->addChild(createSubmenuItem("Gain and offset", "", [=](Menu *menu) {
+			for(int i = 0; i < module->numPorts; i++) {
+				std::string rightText = string::f("%s%gx %+gV", module->inverted[i] ? "-" : "", module->gains[i].load(), module->offsets[i].load());
+				menu->addChild(createSubmenuItem(string::f("Port %d", i + 1), rightText, [=](Menu *menu) {
+					menu->addChild(createSubmenuItem("Gain", string::f("%g", module->gains[i].load()), [=](Menu *menu) {
+						menu->addChild(createMenuLabel("Gain, press enter to apply"));
+						TeleportValueField *field = new TeleportValueField();
+						field->action = [=](std::string text) { module->gains[i] = clamp((float) std::atof(text.c_str()), -10.f, 10.f); };
+						field->box.size.x = 100.f;
+						field->setText(string::f("%g", module->gains[i].load()));
+						field->selectAll();
+						menu->addChild(field);
+					}));
+					menu->addChild(createSubmenuItem("Offset", string::f("%g V", module->offsets[i].load()), [=](Menu *menu) {
+						menu->addChild(createMenuLabel("Offset in volts, press enter to apply"));
+						TeleportValueField *field = new TeleportValueField();
+						field->action = [=](std::string text) { module->offsets[i] = clamp((float) std::atof(text.c_str()), -10.f, 10.f); };
+						field->box.size.x = 100.f;
+						field->setText(string::f("%g", module->offsets[i].load()));
+						field->selectAll();
+						menu->addChild(field);
+					}));
+					menu->addChild(createAtomicBoolMenuItem("Invert", &module->inverted[i]));
+				}));
+			}
+		}));
+		menu->addChild(createSubmenuItem("Send bus", module->sendBus, [=](Menu *menu) {
+			menu->addChild(createMenuLabel("Bus name, press enter to apply"));
+			TeleportValueField *field = new TeleportValueField();
+			field->action = [=](std::string bus) { module->setSendBus(bus); };
+			field->box.size.x = 100.f;
+			field->placeholder = "None";
+			field->setText(module->sendBus);
+			field->selectAll();
+			menu->addChild(field);
+		}));
+
+		TeleportInModuleWidget *widget = this;
+		menu->addChild(createSubmenuItem("Diagnostics", "", [=](Menu *menu) {
+			TeleportSourceStats &stats = module->stats;
+			menu->addChild(createMenuLabel(string::f("Frames published: %llu (%.0f/s)",
+				(unsigned long long) stats.framesPublished.load(), widget->publishRate.rate)));
+			menu->addChild(createMenuLabel(string::f("Channels published: %llu", (unsigned long long) stats.channelsPublished.load())));
+			menu->addChild(createMenuLabel(string::f("Frames pushed to outputs: %llu", (unsigned long long) stats.framesPushed.load())));
+			menu->addChild(createMenuLabel(string::f("Label changes: %llu", (unsigned long long) stats.labelChanges.load())));
+			appendTeleportDiagnosticsItems(menu);
+		}));
+
+		menu->addChild(new MenuLabel());
+		TeleportRecorder *recorder = module->recorder.load();
+		if(recorder) {
+			menu->addChild(createMenuItem("Stop recording", "", [=]() { module->stopRecording(); }));
+			menu->addChild(createMenuLabel(string::f("Recorded %.1f s, dropped %llu samples",
+				recorder->getFramesRecorded() / recorder->sampleRate,
+				(unsigned long long) recorder->framesDropped.load())));
+		} else {
+			menu->addChild(createIndexPtrSubmenuItem("Recording channels",
+				{"First channel of each port", "All 16 channels of each port"}, &module->recordLayout));
+			menu->addChild(createMenuItem("Start recording...", "", [=]() {
+				osdialog_filters *filters = osdialog_filters_parse("WAV (32-bit float):wav;Raw 32-bit float:raw,f32");
+				char *path = osdialog_file(OSDIALOG_SAVE, NULL, (module->label + ".wav").c_str(), filters);
+				osdialog_filters_free(filters);
+				if(path) {
+					module->startRecording(path);
+					std::free(path);
+				}
+			}));
+			if(module->lastRecordingDropped > 0) {
+				menu->addChild(createMenuLabel(string::f("Last recording dropped %llu samples",
+					(unsigned long long) module->lastRecordingDropped)));
+			}
 		}
 	}
 
@@ -553,16 +2986,177 @@ struct TeleportInModuleWidget : TeleportModuleWidget {
 
 struct TeleportOutModuleWidget : TeleportModuleWidget {
 	TeleportSourceSelectorTextBox *labelDisplay;
+	TeleportOutModule *outModule;
+	GUITimer maintainTimer;
+	TeleportRateMeter deliverRate;
 
 	TeleportOutModuleWidget(TeleportOutModule *module) : TeleportModuleWidget(module, "res/TeleportOut.svg") {
+		outModule = module;
 		labelDisplay = new TeleportSourceSelectorTextBox();
 		labelDisplay->module = module;
 		addLabelDisplay(labelDisplay);
 
-		for(int i = 0; i < NUM_TELEPORT_INPUTS; i++) {
-			float y = getPortYCoord(i);
-			addOutput(createOutputCentered<TeleportOutPortWidget>(Vec(22.5, y), module, TeleportOutModule::OUTPUT_1 + i));
-			addChild(createTinyLightForPort<GreenRedLight>(Vec(22.5, y), module, TeleportOutModule::OUTPUT_1_LIGHTG + 2*i));
+		for(int i = 0; i < TELEPORT_MAX_PORTS; i++) {
+			PortWidget *port = createOutputCentered<TeleportOutPortWidget>(getPortPos(i), module, TeleportOutModule::OUTPUT_1 + i);
+			Widget *light = createTinyLightForPort<GreenRedLight>(getPortPos(i), module, TeleportOutModule::OUTPUT_1_LIGHTG + 2*i);
+			addOutput(port);
+			addChild(light);
+			portWidgets.push_back(port);
+			portLights.push_back(light);
+		}
+		updatePorts();
+	}
+
+	void step() override {
+		TeleportModuleWidget::step();
+		if(outModule) {
+			deliverRate.update(outModule->stats.framesDelivered.load(std::memory_order_relaxed));
+		}
+		if(outModule && !maintainTimer.process()) {
+			outModule->maintainRemote();
+			// Sources created through TeleportApi.hpp have no widget to grow
+			// their history, so the outputs reading them do it.
+			outModule->requestDelays();
+			maintainTimer.trigger(1.f);
+		}
+	}
+
+	void appendContextMenu(ui::Menu* menu) override {
+		TeleportOutModule *module = outModule;
+		menu->addChild(new MenuLabel());
+		menu->addChild(createBoolMenuItem("Deterministic (one sample latency)", "",
+			[=]() { return module->deterministic.load(); },
+			[=](bool deterministic) {
+				module->deterministic = deterministic;
+				module->updateSubscription();
+			}));
+		appendPortCountMenu(menu, [=](int n) { module->setNumPorts(n); });
+
+		if(!module->remote) {
+			menu->addChild(createBoolMenuItem("Routing matrix", "",
+				[=]() { return module->matrix.load(); },
+				[=](bool matrix) {
+					module->matrix = matrix;
+					module->busReturn = false;
+					module->updateSubscription();
+				}));
+			menu->addChild(createBoolMenuItem("Return from send bus", "",
+				[=]() { return module->busReturn.load(); },
+				[=](bool busReturn) {
+					module->busReturn = busReturn;
+					module->matrix = false;
+					module->setLabel("");
+				}));
+			if(!module->matrix && !module->busReturn) {
+				menu->addChild(createBoolMenuItem("Pack ports into polyphonic port 1", "",
+					[=]() { return module->polyPack.load(); },
+					[=](bool polyPack) {
+						module->polyPack = polyPack;
+						module->updateSubscription();
+					}));
+			}
+		}
+		if(!module->remote && module->matrix) {
+			menu->addChild(createSubmenuItem("Routing", "", [=](Menu *menu) {
+				appendTeleportRoutingMenu(menu, module);
+			}));
+			static const std::vector<float> crossfadeTimes = {0.f, 0.001f, 0.005f, 0.02f, 0.1f};
+			menu->addChild(createIndexSubmenuItem("Crossfade", {"Off", "1 ms", "5 ms", "20 ms", "100 ms"},
+				[=]() {
+					auto it = std::find(crossfadeTimes.begin(), crossfadeTimes.end(), module->crossfadeTime);
+					return it != crossfadeTimes.end() ? it - crossfadeTimes.begin() : -1;
+				},
+				[=](size_t i) { module->crossfadeTime = crossfadeTimes[i]; }));
+		} else if(!module->remote && !module->busReturn && !module->polyPack) {
+			menu->addChild(createSubmenuItem("Delay", "", [=](Menu *menu) {
+				for(int i = 0; i < module->numPorts; i++) {
+					menu->addChild(createSubmenuItem(string::f("Port %d", i + 1), string::f("%g", module->delays[i].load()), [=](Menu *menu) {
+						menu->addChild(createMenuLabel("Delay in samples, press enter to apply"));
+						TeleportValueField *field = new TeleportValueField();
+						field->action = [=](std::string text) { module->setDelay(i, std::atof(text.c_str())); };
+						field->box.size.x = 100.f;
+						field->setText(string::f("%g", module->delays[i].load()));
+						field->selectAll();
+						menu->addChild(field);
+					}));
+				}
+			}));
+			menu->addChild(createAtomicBoolMenuItem("Interpolate fractional delays", &module->fractionalDelay));
+
+			menu->addChild(createSubmenuItem("Control rate", "", [=](Menu *menu) {
+				for(int i = 0; i < module->numPorts; i++) {
+					menu->addChild(createAtomicBoolMenuItem(string::f("Port %d", i + 1), &module->cvRate[i]));
+				}
+			}));
+			static const std::vector<int> divisions = {4, 8, 16, 32, 64, 128, 256};
+			std::vector<std::string> divisionLabels;
+			for(int d : divisions) {
+				divisionLabels.push_back(string::f("Every %d samples", d));
+			}
+			menu->addChild(createIndexSubmenuItem("Control rate update", divisionLabels,
+				[=]() {
+					auto it = std::find(divisions.begin(), divisions.end(), module->cvDivision);
+					return it != divisions.end() ? it - divisions.begin() : -1;
+				},
+				[=](size_t i) { module->cvDivision = divisions[i]; }));
+			menu->addChild(createAtomicIndexSubmenuItem("Control rate smoothing", {"None (hold)", "Linear", "One-pole"}, &module->cvSmoothing));
+		}
+
+		TeleportOutModuleWidget *widget = this;
+		menu->addChild(createSubmenuItem("Diagnostics", "", [=](Menu *menu) {
+			TeleportLinkStats &stats = module->stats;
+			menu->addChild(createMenuLabel(string::f("Frames delivered: %llu (%.0f/s)",
+				(unsigned long long) stats.framesDelivered.load(), widget->deliverRate.rate)));
+			menu->addChild(createMenuLabel(string::f("Channels moved: %llu", (unsigned long long) stats.channelsMoved.load())));
+			menu->addChild(createMenuLabel(string::f("Frames without source: %llu", (unsigned long long) stats.missingSourceFrames.load())));
+			menu->addChild(createMenuLabel(string::f("Stale reads: %llu", (unsigned long long) stats.staleReads.load())));
+			menu->addChild(createMenuLabel(string::f("Label switches: %llu", (unsigned long long) stats.labelSwitches.load())));
+			appendTeleportDiagnosticsItems(menu);
+		}));
+
+		menu->addChild(new MenuLabel());
+		menu->addChild(createBoolMenuItem("Receive from other Rack instances", "",
+			[=]() { return module->remote.load(); },
+			[=](bool remote) {
+				module->remote = remote;
+				// remote sources can't be routed or summed
+				module->matrix = module->matrix && !remote;
+				module->busReturn = module->busReturn && !remote;
+				module->setLabel("");
+				module->updateRemote();
+			}));
+		if(!module->remote) {
+			return;
+		}
+
+		static const std::vector<int> latencies = {32, 64, 128, 256, 512, 1024, 2048};
+		std::vector<std::string> latencyLabels;
+		for(int l : latencies) {
+			latencyLabels.push_back(string::f("%d samples", l));
+		}
+		menu->addChild(createIndexSubmenuItem("Latency", latencyLabels,
+			[=]() {
+				auto it = std::find(latencies.begin(), latencies.end(), module->shmLatency);
+				return it != latencies.end() ? it - latencies.begin() : -1;
+			},
+			[=](size_t i) { module->shmLatency = latencies[i]; }));
+		menu->addChild(createAtomicIndexSubmenuItem("On underrun", {"Hold last frame", "Output silence"}, &module->underrunPolicy));
+		menu->addChild(createAtomicIndexSubmenuItem("On clock drift", {"Skip or repeat single samples", "Jump back to latency"}, &module->driftPolicy));
+
+		TeleportShmReader *reader = module->shmReader.load();
+		if(reader) {
+			TeleportShmStats &stats = reader->stats;
+			menu->addChild(createMenuLabel(string::f("Frames read: %llu", (unsigned long long) stats.framesRead.load())));
+			menu->addChild(createMenuLabel(string::f("Underruns: %llu, overruns: %llu",
+				(unsigned long long) stats.underruns.load(), (unsigned long long) stats.overruns.load())));
+			menu->addChild(createMenuLabel(string::f("Skipped/repeated: %llu, resyncs: %llu",
+				(unsigned long long) stats.slips.load(), (unsigned long long) stats.resyncs.load())));
+			float remoteRate = reader->segment->header->sampleRate;
+			if(APP->engine && remoteRate != APP->engine->getSampleRate()) {
+				menu->addChild(createMenuLabel(string::f("Sample rate of source differs: %g Hz", remoteRate)));
+			}
+		} else if(!module->label.empty()) {
+			menu->addChild(createMenuLabel("Not connected"));
 		}
 	}
 
@@ -571,3 +3165,117 @@ struct TeleportOutModuleWidget : TeleportModuleWidget {
 
 Model *modelTeleportInModule = createModel<TeleportInModule, TeleportInModuleWidget>("TeleportIn");
 Model *modelTeleportOutModule = createModel<TeleportOutModule, TeleportOutModuleWidget>("TeleportOut");
+
+
+/////////////////////////////////
+// interface for other plugins //
+/////////////////////////////////
+
+// See TeleportApi.hpp.
+struct LittleUtilsTeleportReader {
+	int labelId;
+};
+
+static bool apiSourceExists(const char *label) {
+	return Teleport::sourceExists(label);
+}
+
+static LittleUtilsTeleportReader* apiOpenReader(const char *label) {
+	LittleUtilsTeleportReader *reader = new LittleUtilsTeleportReader();
+	reader->labelId = Teleport::acquireLabelId(label);
+	Teleport::changeHistoryReaders({}, {reader->labelId});
+	return reader;
+}
+
+static void apiCloseReader(LittleUtilsTeleportReader *reader) {
+	Teleport::changeHistoryReaders({reader->labelId}, {});
+	Teleport::releaseLabelId(reader->labelId);
+	delete reader;
+}
+
+static TeleportInModule* apiGetSource(LittleUtilsTeleportReader *reader) {
+	const TeleportSnapshot *s = Teleport::snapshot.load(std::memory_order_acquire);
+	return reader->labelId < (int) s->sourcesById.size() ? s->sourcesById[reader->labelId] : NULL;
+}
+
+static int apiRead(LittleUtilsTeleportReader *reader, int64_t frame, int port, float *voltages) {
+	TeleportInModule *source = apiGetSource(reader);
+	if(!source || port < 0 || port >= TELEPORT_MAX_PORTS) {
+		return -1;
+	}
+	const TeleportHistory *h = source->history[port].load(std::memory_order_acquire);
+	const int slot = h->getSlot(frame - 1);
+	if(!h->hasFrame(slot, frame - 1)) {
+		return -1;
+	}
+	const int channels = h->getChannels(slot);
+	// not straight into voltages, the caller's buffer may be exactly 16
+	// floats and readVoltages() rounds up
+	float v[MAX_POLY_CHANNELS];
+	h->readVoltages(slot, v, channels);
+	std::memcpy(voltages, v, channels * sizeof(float));
+	return channels;
+}
+
+static int apiGetNumPorts(LittleUtilsTeleportReader *reader) {
+	TeleportInModule *source = apiGetSource(reader);
+	return source ? source->numPorts.load() : 0;
+}
+
+// A source is a TeleportInModule that is never added to the engine. Its
+// inputs are set by setPort() instead of cables.
+static LittleUtilsTeleportSource* apiCreateSource(const char *label, int numPorts) {
+	TeleportInModule *t = new TeleportInModule();
+	if(!t->updateLabel(label)) {
+		delete t;
+		return NULL;
+	}
+	t->numPorts = clamp(numPorts, 1, TELEPORT_MAX_PORTS);
+	return (LittleUtilsTeleportSource*) t;
+}
+
+static void apiDestroySource(LittleUtilsTeleportSource *source) {
+	TeleportInModule *t = (TeleportInModule*) source;
+	// Outputs may still be reading t through a snapshot or their cached
+	// source, so unregister it first and only free it once they're done.
+	t->removeSource(t);
+	Teleport::removeSender(t);
+	Teleport::retire(t);
+}
+
+static void apiSetPort(LittleUtilsTeleportSource *source, int port, const float *voltages, int channels) {
+	TeleportInModule *t = (TeleportInModule*) source;
+	if(port < 0 || port >= t->numPorts) {
+		return;
+	}
+	Input &input = t->inputs[TeleportInModule::INPUT_1 + port];
+	// Not setChannels(), that ignores inputs without a cable, which is all
+	// of them here.
+	input.channels = clamp(channels, 0, MAX_POLY_CHANNELS);
+	std::memcpy(input.getVoltages(), voltages, input.getChannels() * sizeof(float));
+}
+
+static void apiPublish(LittleUtilsTeleportSource *source, int64_t frame) {
+	((TeleportInModule*) source)->publishFrame(frame);
+}
+
+extern "C" __attribute__((visibility("default")))
+#if defined ARCH_WIN
+__declspec(dllexport)
+#endif
+const LittleUtilsTeleportApi* littleUtilsGetTeleportApi() {
+	static const LittleUtilsTeleportApi api = {
+		LITTLE_UTILS_TELEPORT_API_VERSION,
+		sizeof(LittleUtilsTeleportApi),
+		apiSourceExists,
+		apiOpenReader,
+		apiCloseReader,
+		apiRead,
+		apiGetNumPorts,
+		apiCreateSource,
+		apiDestroySource,
+		apiSetPort,
+		apiPublish,
+	};
+	return &api;
+}
@@ -1,26 +1,323 @@
+#pragma once
 #include "plugin.hpp"
 #include <vector>
 #include <map>
+#include <atomic>
+#include <mutex>
+#include <functional>
 
-#define NUM_TELEPORT_INPUTS 8
+#define NUM_TELEPORT_INPUTS 8 // default number of ports, and ports per column on the panel
+#define TELEPORT_MAX_PORTS 64
 
 struct TeleportInModule;
+struct TeleportOutModule;
+
+// Immutable view of all existing teleport sources. The registry is never
+// modified in place: writers (the GUI thread) publish a new snapshot and
+// retire the old one, readers (engine threads) only load the current pointer.
+struct TeleportSnapshot {
+	// We're using a map instead of a set because it's easier to search.
+	std::map<std::string, TeleportInModule*> sources;
+	// Indexed by interned label ID, NULL if no source currently has that label.
+	std::vector<TeleportInModule*> sourcesById;
+	// Teleport outputs that have selected each label, indexed by label ID.
+	// Sources push their signals to these once per sample, see
+	// TeleportInModule::pushToSubscribers().
+	std::vector<std::vector<TeleportOutModule*>> subscribersById;
+	// Sources sending to each send bus, indexed by the label ID of the bus
+	// name and sorted by module ID, so that the sum over them is always done
+	// in the same order.
+	std::vector<std::vector<TeleportInModule*>> sendersById;
+	// Number of outputs and API readers reading the history of the source
+	// with each label ID, or of the senders to each bus, indexed by label ID.
+	// Sources only write their history while it has readers.
+	std::vector<int> historyReadersById;
+	unsigned int version = 0;
+
+	bool hasHistoryReaders(int id) const {
+		return id >= 0 && id < (int) historyReadersById.size() && historyReadersById[id] > 0;
+	}
+};
+
+// Copy the used voltage lanes of a port, four lanes at a time. Ports and
+// frames have room for all MAX_POLY_CHANNELS lanes, so also copying up to three
+// unused lanes at the end is harmless.
+inline void copyVoltages(float *to, const float *from, int channels) {
+	for(int c = 0; c < channels; c += 4) {
+		simd::float_4::load(from + c).store(to + c);
+	}
+}
+
+#define TELEPORT_CACHE_LINE 64 // bytes
+
+// One sample of all signals of a teleport source. The channel counts take a
+// whole number of cache lines and the voltages of each port exactly one, so a
+// frame allocated with new starts on a cache line boundary and no two ports
+// share a line.
+struct TeleportFrame {
+	int channels[TELEPORT_MAX_PORTS];
+	float voltages[TELEPORT_MAX_PORTS][MAX_POLY_CHANNELS];
+
+	// Before C++17, new only guarantees the alignment of the largest scalar
+	// type, so align by hand. The original pointer is kept right before the
+	// frame.
+	static void* operator new(size_t size) {
+		char *mem = (char*) ::operator new(size + TELEPORT_CACHE_LINE + sizeof(void*));
+		uintptr_t start = (uintptr_t) (mem + sizeof(void*));
+		char *frame = (char*) ((start + TELEPORT_CACHE_LINE - 1) & ~(uintptr_t) (TELEPORT_CACHE_LINE - 1));
+		((void**) frame)[-1] = mem;
+		return frame;
+	}
+	static void operator delete(void *frame) {
+		if(frame) {
+			::operator delete(((void**) frame)[-1]);
+		}
+	}
+};
+static_assert(sizeof(TeleportFrame::channels) % TELEPORT_CACHE_LINE == 0, "channel counts must fill whole cache lines");
+static_assert(sizeof(TeleportFrame::voltages[0]) == TELEPORT_CACHE_LINE, "each port must fill one cache line");
+
+// Diagnostic counters. Each counter has a single writer, usually the engine
+// thread, so a relaxed load and store is enough to increment it. The GUI only
+// reads them.
+struct TeleportCounters {
+	inline void increment(std::atomic<uint64_t> &counter, uint64_t n = 1) {
+		counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+};
+
+struct TeleportSourceStats : TeleportCounters {
+	std::atomic<uint64_t> framesPublished{0};
+	std::atomic<uint64_t> channelsPublished{0};
+	std::atomic<uint64_t> framesPushed{0}; // summed over all subscribers
+	std::atomic<uint64_t> labelChanges{0}; // written by the GUI thread
+
+	json_t* toJson() const;
+};
+
+struct TeleportLinkStats : TeleportCounters {
+	std::atomic<uint64_t> framesDelivered{0};
+	std::atomic<uint64_t> channelsMoved{0};
+	std::atomic<uint64_t> missingSourceFrames{0};
+	// Reads of a committed frame that wasn't there, because the source
+	// wasn't processed during that engine frame (e.g. it was just added or
+	// renamed, or its history was just grown).
+	std::atomic<uint64_t> staleReads{0};
+	std::atomic<uint64_t> labelSwitches{0}; // written by the GUI thread
+
+	json_t* toJson() const;
+};
+
+#define TELEPORT_MATRIX_FADES 4 // routes of a matrix port that can be fading out at once
+
+#define TELEPORT_MAX_DELAY 65535 // samples, one less than the largest history
+
+// The recent history of one port of a teleport source, for outputs that read
+// it with a delay. During engine frame n the source writes slot n % size, so
+// an output reading frame n - d with 1 <= d < size never touches the slot
+// being written, regardless of module order or engine threads.
+//
+// The GUI thread copies slots while the source writes them when the ring is
+// grown, see copyFrom(). So every slot is a small seqlock: the stamp is -1
+// while the slot is being written, and the engine frame it was written
+// during once it's complete. Everything is atomic, the payload with relaxed
+// accesses that compile to plain loads and stores.
+struct TeleportHistory {
+	int size; // power of two, at least 2
+	std::vector<std::atomic<int64_t>> stamps;
+	std::vector<std::atomic<int>> channels;
+	std::vector<std::atomic<float>> voltages; // MAX_POLY_CHANNELS per slot
+
+	TeleportHistory(int size) : size(size), stamps(size), channels(size), voltages(size * MAX_POLY_CHANNELS) {
+		for(int s = 0; s < size; s++) {
+			stamps[s].store(-1, std::memory_order_relaxed);
+			channels[s].store(0, std::memory_order_relaxed);
+		}
+		for(int k = 0; k < size * MAX_POLY_CHANNELS; k++) {
+			voltages[k].store(0.f, std::memory_order_relaxed);
+		}
+	}
+
+	inline int getSlot(int64_t frame) const {
+		return frame & (size - 1);
+	}
+	// Whether slot holds what was written during the given engine frame.
+	inline bool hasFrame(int slot, int64_t frame) const {
+		return stamps[slot].load(std::memory_order_acquire) == frame;
+	}
+	inline int getChannels(int slot) const {
+		return channels[slot].load(std::memory_order_relaxed);
+	}
+	inline float getVoltage(int slot, int c) const {
+		return voltages[slot * MAX_POLY_CHANNELS + c].load(std::memory_order_relaxed);
+	}
+	// Like copyVoltages(), whole groups of four channels.
+	inline void readVoltages(int slot, float *to, int channels) const {
+		const std::atomic<float> *from = &voltages[slot * MAX_POLY_CHANNELS];
+		for(int c = 0; c < (channels + 3) / 4 * 4; c++) {
+			to[c] = from[c].load(std::memory_order_relaxed);
+		}
+	}
+
+	// Write a frame to its slot. Engine thread of the source only.
+	void write(int64_t frame, const float *from, int numChannels);
+
+	// Copy the frames of from that this ring doesn't have yet. from may be
+	// written by the source at the same time, frames that change while being
+	// copied are skipped. This ring must be larger than from, so that the slots
+	// written here are never the one the source is writing.
+	void copyFrom(const TeleportHistory &from);
+};
+
+// Hands out unique random labels of 4 alphanumeric characters. Which labels
+// of that space are taken is tracked in a bitmap, so finding a free one is a
+// random start position and a scan for the next zero bit, skipping full words
+// at a time. That takes constant time as long as the space isn't nearly full,
+// unlike generating random labels until one happens to be free.
+struct TeleportLabelAllocator {
+	static const int length = 4;
+	static const std::string charset;
+	std::vector<uint64_t> taken; // one bit per label, allocated on first use
+
+	// The position of lbl in the label space, or -1 if it isn't in it (e.g.
+	// a label typed in by the user with other characters).
+	static int64_t getIndex(const std::string &lbl);
+	static std::string getLabel(int64_t index);
+	static int64_t getSpaceSize();
+
+	void setTaken(const std::string &lbl, bool isTaken);
+	// Return a random label that isn't taken, without taking it.
+	std::string allocate();
+};
 
 struct Teleport : Module {
 	std::string label;
+	// Interned ID of label, -1 if there is no label (or for sources, if this
+	// module isn't registered). The label itself is only touched from the GUI
+	// thread.
+	std::atomic<int> labelId{-1};
+	// Number of ports in use, set per instance. All TELEPORT_MAX_PORTS ports
+	// are always configured so that port IDs don't depend on this, the rest
+	// are hidden. Set by the GUI thread, read by the engine.
+	std::atomic<int> numPorts{NUM_TELEPORT_INPUTS};
 	Teleport(int numParams, int numInputs, int numOutputs, int numLights = 0) {
 		config(numParams, numInputs, numOutputs, numLights);
 	}
 
-	// This static map is used for keeping track of all existing Teleport instances.
-	// We're using a map instead of a set because it's easier to search.
-	static std::map<std::string, TeleportInModule*> sources;
+	// The snapshot of all existing Teleport sources. Loading it is wait-free,
+	// the audio thread never blocks on or sees a half-done registry update.
+	static std::atomic<const TeleportSnapshot*> snapshot;
+	// Same as snapshot->version, but can be polled without touching the
+	// snapshot. Outputs look up their source again when this changes.
+	static std::atomic<unsigned int> sourcesVersion;
+
+	// Serializes writers and protects the static members below. This is only
+	// ever locked from the GUI thread, never from process().
+	static std::mutex writeMutex;
 	static std::string lastInsertedKey; // this is used to assign the label of an output initially
+	// Labels are interned to integer IDs so that teleport outputs can find
+	// their source in process() without any string comparisons. Each module
+	// or API reader holding an ID counts as a reference to it, and once the
+	// last one is gone the ID is handed out again, so the tables indexed by
+	// ID only grow with the number of labels in use. See acquireLabelId().
+	static std::map<std::string, int> labelIds;
+	static std::vector<std::string> labelsById;
+	static std::vector<int> labelRefs; // by ID
+	static std::vector<int> freeLabelIds;
+	// The labels of all sources.
+	static TeleportLabelAllocator labelAllocator;
+	// Deleters for objects that have been unpublished (e.g. replaced
+	// snapshots), and the engine frame when that happened. A reader only
+	// holds on to such an object during a single process() call, so they are
+	// freed once the engine has moved on.
+	static std::vector<std::pair<std::function<void()>, int64_t>> retired;
+	// The engine frame the above are counted in, -1 without an engine. Only
+	// replaced when running the modules without Rack's engine, see bench/.
+	static std::function<int64_t()> getEngineFrame;
+	// While modules are being pasted or a patch is being loaded, changes to
+	// the registry are collected in draft instead of copying the snapshot for
+	// every module, and published all at once by endPaste(). Only with a UI
+	// to call that, i.e. not in headless mode.
+	static bool batching;
+	static TeleportSnapshot *draft; // NULL if there are no unpublished changes
 
 	void addSource(TeleportInModule *t);
+	// Give t a new unique label and add it to the sources.
+	void addSourceWithNewLabel(TeleportInModule *t);
+	// Remove t from the sources, if it's still registered under its label.
+	void removeSource(TeleportInModule *t);
+	// Return the ID of lbl and count a reference to it. Every acquired ID
+	// must be released again, IDs of -1 are ignored.
+	static int acquireLabelId(std::string lbl);
+	static void releaseLabelId(int id);
+	// Add or remove t from the subscribers of the label with the given ID.
+	static void subscribe(TeleportOutModule *t, int id);
+	static void unsubscribe(TeleportOutModule *t, int id);
+	// Add t to or remove it from the senders of its send bus.
+	static void addSender(TeleportInModule *t);
+	static void removeSender(TeleportInModule *t);
+	// Count a history reader of each label ID in to instead of each in from.
+	static void changeHistoryReaders(const std::vector<int> &from, const std::vector<int> &to);
+
+	// These lock writeMutex, only use them outside of process().
+	static bool sourceExists(std::string lbl);
+	static TeleportInModule* getSource(std::string lbl);
+	static TeleportInModule* getSourceById(int id);
+	// At most limit labels starting with prefix, in alphabetical order.
+	static std::vector<std::string> findSourceLabels(std::string prefix, size_t limit);
+	// Names of all send buses that have at least one sender, in alphabetical order.
+	static std::vector<std::string> findBusLabels();
+	// Counters of all sources and outputs, grouped by label. Locks the
+	// engine, so don't call this from process().
+	static json_t* diagnosticsToJson();
+	// All teleport links in the engine, with the latency of each port in
+	// samples and the feedback loops through them. Locks the engine, so
+	// don't call this from process().
+	static json_t* routingGraphToJson();
+	// The same graph in Graphviz format.
+	static std::string routingGraphToDot(json_t *graph);
 
-	inline bool sourceExists(std::string lbl) {
-		return sources.find(lbl) != sources.end();
+	// When a group of modules is pasted, Rack calls dataFromJson() of each of
+	// them in turn. Sources whose labels collide with existing ones are
+	// renamed, and outputs pasted along with them should follow the rename
+	// instead of sticking with the original source. The renames are collected
+	// here until the next UI frame, when the paste is done. GUI thread only.
+	static std::map<std::string, std::string> pasteRenames;
+	static std::vector<TeleportOutModule*> pastedOutputs;
+	static void addPasteRename(std::string from, std::string to);
+	// Return the label that a pasted output with label lbl should use.
+	static std::string getPastedLabel(std::string lbl, TeleportOutModule *t);
+	// Called by modules being created or read from JSON, which is what both
+	// pasting and loading a patch look like from here.
+	static void beginPaste();
+	// Set from beginPaste() until endPaste(). The first Teleport widget to
+	// step in a UI frame ends the paste if this is set, the others skip it.
+	static bool pasting;
+	static void endPaste();
+
+	// Helpers for the above, writeMutex must be held when calling these.
+	static int acquireLabelIdLocked(std::string lbl);
+	static void releaseLabelIdLocked(int id);
+	static void addSourceLocked(TeleportInModule *t);
+	// The registry as the GUI thread sees it, including the draft.
+	static const TeleportSnapshot* getLatestLocked();
+	// Return the draft to modify, and publish it afterwards with
+	// commitSnapshotLocked(). While batching that waits for endPaste(),
+	// unless now is set. Anything removed from the published snapshot must
+	// be published right away, since the module may be freed right after.
+	static TeleportSnapshot* editSnapshotLocked();
+	static void commitSnapshotLocked(bool now);
+	static void publishSnapshot(TeleportSnapshot *s);
+	static void retireLocked(std::function<void()> deleter);
+	static void collectRetired();
+
+	// Free obj once no process() call can be using it anymore. Use this for
+	// anything an engine thread may have loaded through an atomic pointer.
+	template <typename T>
+	static void retire(T *obj) {
+		if(!obj) return;
+		std::lock_guard<std::mutex> lock(writeMutex);
+		retireLocked([obj]() { delete obj; });
 	}
 };
 
@@ -29,9 +326,21 @@ struct Teleport : Module {
 struct TeleportOutPortWidget;
 struct TeleportOutPortTooltip : ui::Tooltip {
 	TeleportOutPortWidget* portWidget;
-	void step() override;
-};
 
+	// The parts of the text that depend on the cables are only rebuilt when
+	// the source or the cables change. The source is found through the
+	// snapshot, and only the cables on this port and on the source port are
+	// looked up. The voltages are only formatted again when they change.
+	TeleportInModule* source = NULL;
+	int sourcePortId = -1; // the input of source that feeds this port
+	std::vector<int64_t> cableIds; // of the cables out of this port, then the one into the source port
+	std::string cableText;
+	std::string teleportText;
+	int lastChannels = -1;
+	float lastVoltages[MAX_POLY_CHANNELS] = {};
+	std::string voltageText;
 
-std::map<std::string, TeleportInModule*> Teleport::sources = {};
-std::string Teleport::lastInsertedKey = "";
+	void step() override;
+	void updateCableText(const std::vector<app::CableWidget*> &outgoing, app::CableWidget *incoming);
+	bool updateVoltageText();
+};
@@ -0,0 +1,99 @@
+#pragma once
+// Public interface to the teleport registry of Little Utils, for other
+// plugins. This header doesn't depend on anything else in this plugin, copy
+// it into your own source tree.
+//
+// Each Rack plugin is a separate library with its own copy of any static
+// data, so the registry can't be linked against directly. Instead, this
+// plugin exports a single function that returns a table of function
+// pointers, see littleUtilsLoadTeleportApi() below.
+//
+// Real-time guarantees are the same as for the built-in Teleport modules:
+// the functions marked "engine thread" are wait-free and never allocate, and
+// may be called from Module::process(). All other functions may lock or
+// allocate, call them from the GUI thread (or the constructor, destructor,
+// onAdd() or onRemove() of your module).
+
+#include <stdint.h>
+
+#define LITTLE_UTILS_TELEPORT_API_VERSION 1
+#define LITTLE_UTILS_TELEPORT_API_SYMBOL "littleUtilsGetTeleportApi"
+
+extern "C" {
+
+// Opaque handles.
+struct LittleUtilsTeleportReader;
+struct LittleUtilsTeleportSource;
+
+struct LittleUtilsTeleportApi {
+	// LITTLE_UTILS_TELEPORT_API_VERSION of the plugin. Functions are only
+	// ever added to the end of this struct, check size before using any
+	// function added after version 1.
+	uint32_t version;
+	uint32_t size; // sizeof(LittleUtilsTeleportApi) of the plugin
+
+	// Whether a source with the given label currently exists.
+	bool (*sourceExists)(const char *label);
+
+	// Read the signals of the source with the given label. The source
+	// doesn't need to exist yet, the reader picks it up when it appears.
+	LittleUtilsTeleportReader* (*openReader)(const char *label);
+	void (*closeReader)(LittleUtilsTeleportReader *reader);
+	// Engine thread. Copy the voltages of port (0-based) that the source
+	// committed during the engine frame before frame (e.g. args.frame in
+	// process()) to voltages, which must have room for 16 floats. Return the
+	// number of channels, or -1 if the source doesn't exist or didn't
+	// commit that frame. This adds one sample of latency, the same as
+	// "Deterministic" on Teleport Out, but doesn't depend on module order or
+	// engine threads.
+	int (*read)(LittleUtilsTeleportReader *reader, int64_t frame, int port, float *voltages);
+	// Engine thread. Number of ports of the source, 0 if it doesn't exist.
+	int (*getNumPorts)(LittleUtilsTeleportReader *reader);
+
+	// Publish signals under a new label, the same way a Teleport In does.
+	// Return NULL if the label is already taken. numPorts is between 1 and
+	// 64.
+	LittleUtilsTeleportSource* (*createSource)(const char *label, int numPorts);
+	// Remove the source. No engine thread may be publishing to it, so call
+	// this from onRemove() or the destructor of your module.
+	void (*destroySource)(LittleUtilsTeleportSource *source);
+	// Engine thread. Set the signal of port (0-based) for the next publish().
+	void (*setPort)(LittleUtilsTeleportSource *source, int port, const float *voltages, int channels);
+	// Engine thread. Publish the ports set so far during engine frame frame,
+	// once per sample.
+	void (*publish)(LittleUtilsTeleportSource *source, int64_t frame);
+};
+
+// Exported by Little Utils.
+typedef const LittleUtilsTeleportApi* (*LittleUtilsGetTeleportApiFunc)();
+
+}
+
+#ifdef LITTLE_UTILS_TELEPORT_API_LOADER
+#include <rack.hpp>
+#if defined ARCH_WIN
+	#include <windows.h>
+#else
+	#include <dlfcn.h>
+#endif
+
+// Find the API of the installed Little Utils, or NULL if it isn't installed or
+// too old. Define LITTLE_UTILS_TELEPORT_API_LOADER before including this
+// header in one of your source files to use this.
+inline const LittleUtilsTeleportApi* littleUtilsLoadTeleportApi() {
+	rack::plugin::Plugin *plugin = rack::plugin::getPlugin("LittleUtils");
+	if(!plugin || !plugin->handle) {
+		return NULL;
+	}
+#if defined ARCH_WIN
+	void *symbol = (void*) GetProcAddress((HINSTANCE) plugin->handle, LITTLE_UTILS_TELEPORT_API_SYMBOL);
+#else
+	void *symbol = dlsym(plugin->handle, LITTLE_UTILS_TELEPORT_API_SYMBOL);
+#endif
+	if(!symbol) {
+		return NULL;
+	}
+	const LittleUtilsTeleportApi *api = ((LittleUtilsGetTeleportApiFunc) symbol)();
+	return (api && api->version >= 1) ? api : NULL;
+}
+#endif
@@ -0,0 +1,134 @@
+#include "TeleportRecorder.hpp"
+
+static_assert((TELEPORT_RECORDER_CAPACITY & (TELEPORT_RECORDER_CAPACITY - 1)) == 0, "capacity must be a power of two");
+
+TeleportRecorder* TeleportRecorder::start(std::string path, int format, int layout, int numPorts, float sampleRate) {
+	FILE *file = std::fopen(path.c_str(), "wb");
+	if(!file) {
+		return NULL;
+	}
+	TeleportRecorder *r = new TeleportRecorder();
+	r->file = file;
+	r->format = format;
+	r->layout = layout;
+	r->numPorts = numPorts;
+	r->numChannels = numPorts * (layout == RECORD_POLY ? MAX_POLY_CHANNELS : 1);
+	r->sampleRate = sampleRate;
+	// allocate up front, the engine thread never allocates
+	r->buffer = new float[TELEPORT_RECORDER_CAPACITY * r->numChannels]();
+	if(format == RECORD_WAV) {
+		// placeholder, the sizes are filled in when the recording is stopped
+		r->writeWavHeader(0);
+	}
+	r->running = true;
+	r->thread = std::thread(&TeleportRecorder::run, r);
+	return r;
+}
+
+TeleportRecorder::~TeleportRecorder() {
+	stop();
+	delete[] buffer;
+}
+
+void TeleportRecorder::stop() {
+	if(!file) {
+		return;
+	}
+	running = false;
+	if(thread.joinable()) {
+		thread.join();
+	}
+	// the thread has drained the buffer before exiting
+	if(format == RECORD_WAV) {
+		std::fseek(file, 0, SEEK_SET);
+		writeWavHeader(getFramesRecorded());
+	}
+	std::fclose(file);
+	file = NULL;
+}
+
+void TeleportRecorder::push(Input *inputs) {
+	const uint64_t w = writePos.load(std::memory_order_relaxed);
+	if(w - readPos.load(std::memory_order_acquire) >= TELEPORT_RECORDER_CAPACITY) {
+		framesDropped.store(framesDropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		return;
+	}
+	float *frame = &buffer[(w & (TELEPORT_RECORDER_CAPACITY - 1)) * numChannels];
+	if(layout == RECORD_POLY) {
+		for(int i = 0; i < numPorts; i++) {
+			float *to = &frame[i * MAX_POLY_CHANNELS];
+			const int channels = inputs[i].getChannels();
+			// unused channels are recorded as zeros
+			std::memcpy(to, inputs[i].getVoltages(), channels * sizeof(float));
+			std::memset(to + channels, 0, (MAX_POLY_CHANNELS - channels) * sizeof(float));
+		}
+	} else {
+		for(int i = 0; i < numPorts; i++) {
+			frame[i] = inputs[i].getVoltage(0);
+		}
+	}
+	writePos.store(w + 1, std::memory_order_release);
+}
+
+// Write everything in the buffer to the file, return the number of frames written.
+size_t TeleportRecorder::writeAvailable() {
+	const uint64_t r = readPos.load(std::memory_order_relaxed);
+	const uint64_t w = writePos.load(std::memory_order_acquire);
+	size_t frames = w - r;
+	size_t written = 0;
+	while(written < frames) {
+		// at most two contiguous chunks, before and after the wraparound point
+		const size_t start = (r + written) & (TELEPORT_RECORDER_CAPACITY - 1);
+		const size_t n = std::min(frames - written, (size_t) TELEPORT_RECORDER_CAPACITY - start);
+		std::fwrite(&buffer[start * numChannels], sizeof(float) * numChannels, n, file);
+		written += n;
+	}
+	readPos.store(r + written, std::memory_order_release);
+	return written;
+}
+
+void TeleportRecorder::run() {
+	// write in batches of at least this many frames while recording
+	const size_t batch = TELEPORT_RECORDER_CAPACITY / 8;
+	while(running) {
+		const size_t available = writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_relaxed);
+		if(available >= batch) {
+			writeAvailable();
+		} else {
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		}
+	}
+	writeAvailable();
+}
+
+static void writeLE(FILE *f, uint32_t v, int bytes) {
+	for(int i = 0; i < bytes; i++) {
+		std::fputc((v >> (8 * i)) & 0xff, f);
+	}
+}
+
+void TeleportRecorder::writeWavHeader(uint64_t frames) {
+	// WAVE_FORMAT_EXTENSIBLE with IEEE float samples, required for more than
+	// two channels. Sizes above 4 GiB don't fit, they are clamped.
+	const uint32_t blockAlign = numChannels * sizeof(float);
+	const uint64_t dataSize = std::min<uint64_t>(frames * blockAlign, 0xffffffffu - (4 + 48 + 8));
+	std::fwrite("RIFF", 1, 4, file);
+	writeLE(file, 4 + 48 + 8 + dataSize, 4);
+	std::fwrite("WAVE", 1, 4, file);
+	std::fwrite("fmt ", 1, 4, file);
+	writeLE(file, 40, 4);
+	writeLE(file, 0xfffe, 2); // WAVE_FORMAT_EXTENSIBLE
+	writeLE(file, numChannels, 2);
+	writeLE(file, (uint32_t) sampleRate, 4);
+	writeLE(file, (uint32_t) sampleRate * blockAlign, 4);
+	writeLE(file, blockAlign, 2);
+	writeLE(file, 32, 2); // bits per sample
+	writeLE(file, 22, 2); // size of the extension
+	writeLE(file, 32, 2); // valid bits per sample
+	writeLE(file, 0, 4); // no speaker positions
+	// KSDATAFORMAT_SUBTYPE_IEEE_FLOAT
+	static const uint8_t subFormat[16] = {0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71};
+	std::fwrite(subFormat, 1, 16, file);
+	std::fwrite("data", 1, 4, file);
+	writeLE(file, dataSize, 4);
+}
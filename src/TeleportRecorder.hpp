@@ -0,0 +1,63 @@
+#pragma once
+#include "Teleport.hpp"
+#include <thread>
+
+// Records everything arriving at a teleport source to a file. The engine
+// thread only copies each frame into a preallocated single-producer
+// single-consumer ring buffer, a background thread does the file I/O in
+// large batches. If the writer falls behind and the buffer fills up, frames
+// are dropped and counted instead of blocking the engine.
+
+#define TELEPORT_RECORDER_CAPACITY 32768 // frames, must be a power of two
+
+enum TeleportRecorderLayout {
+	RECORD_MONO, // first channel of each port
+	RECORD_POLY, // all MAX_POLY_CHANNELS channels of each port
+	NUM_RECORD_LAYOUTS
+};
+
+enum TeleportRecorderFormat {
+	RECORD_WAV, // 32-bit float WAV
+	RECORD_RAW, // interleaved 32-bit floats, no header
+	NUM_RECORD_FORMATS
+};
+
+struct TeleportRecorder {
+	FILE *file = NULL;
+	int format = RECORD_WAV;
+	int layout = RECORD_MONO;
+	int numPorts = 0;
+	int numChannels = 0; // per frame in the file
+	float sampleRate = 0.f;
+
+	float *buffer = NULL; // TELEPORT_RECORDER_CAPACITY frames of numChannels floats
+	// Only written by the engine thread and the writer thread, respectively.
+	std::atomic<uint64_t> writePos{0};
+	std::atomic<uint64_t> readPos{0};
+	std::atomic<uint64_t> framesDropped{0};
+
+	std::atomic<bool> running{false};
+	std::thread thread;
+
+	~TeleportRecorder();
+
+	// Open the file and start the writer thread. Return NULL if the file
+	// couldn't be opened.
+	static TeleportRecorder* start(std::string path, int format, int layout, int numPorts, float sampleRate);
+
+	// Stop the writer thread, write out everything that's still buffered and
+	// close the file. GUI thread only.
+	void stop();
+
+	// Called from the source's process(), once per sample.
+	void push(Input *inputs);
+
+	// Frames written to the file so far.
+	uint64_t getFramesRecorded() {
+		return readPos.load(std::memory_order_relaxed);
+	}
+
+	void run();
+	size_t writeAvailable();
+	void writeWavHeader(uint64_t frames);
+};
@@ -0,0 +1,332 @@
+#include "TeleportShm.hpp"
+
+#ifndef ARCH_WIN
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <dirent.h>
+#endif
+
+static const uint32_t TELEPORT_SHM_MAGIC = 0x4c555450; // "LUTP"
+static const uint32_t TELEPORT_SHM_LAYOUT_VERSION = 3;
+// Segment names are this prefix and a 64-bit hash of the label in hex, 22
+// characters in all. Labels can't be used directly, they may contain
+// characters that aren't allowed in names (like '/') and be of any length.
+static const std::string TELEPORT_SHM_PREFIX = "LUTP-";
+
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "atomics in shared memory must be plain integers");
+static_assert((TELEPORT_SHM_CAPACITY & (TELEPORT_SHM_CAPACITY - 1)) == 0, "capacity must be a power of two");
+
+std::string TeleportShmSegment::getName(std::string label) {
+	// FNV-1a, which unlike std::hash is the same in every process
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(unsigned char c : label) {
+		hash = (hash ^ c) * 0x100000001b3ULL;
+	}
+	return "/" + TELEPORT_SHM_PREFIX + string::f("%016llx", (unsigned long long) hash);
+}
+
+size_t TeleportShmSegment::getSlotSize(int numPorts) {
+	size_t size = sizeof(TeleportShmSlot) + numPorts * sizeof(TeleportShmPort);
+	// keep the sequence numbers of all slots aligned
+	const size_t align = alignof(TeleportShmSlot);
+	return (size + align - 1) / align * align;
+}
+
+static size_t getSegmentSize(int numPorts) {
+	return sizeof(TeleportShmHeader) + TELEPORT_SHM_CAPACITY * TeleportShmSegment::getSlotSize(numPorts);
+}
+
+TeleportShmSegment::~TeleportShmSegment() {
+#ifndef ARCH_WIN
+	if(mem) {
+		munmap(mem, size);
+	}
+	if(fd >= 0) {
+		close(fd);
+	}
+	if(owner) {
+		shm_unlink(name.c_str());
+	}
+#endif
+}
+
+void TeleportShmSegment::unlink() {
+#ifndef ARCH_WIN
+	if(owner) {
+		shm_unlink(name.c_str());
+		owner = false;
+	}
+#endif
+}
+
+#ifndef ARCH_WIN
+static bool mapSegment(TeleportShmSegment *s, size_t size, int prot) {
+	s->size = size;
+	s->mem = mmap(NULL, s->size, prot, MAP_SHARED, s->fd, 0);
+	if(s->mem == MAP_FAILED) {
+		s->mem = NULL;
+		return false;
+	}
+	s->header = (TeleportShmHeader*) s->mem;
+	s->slots = (char*) s->mem + sizeof(TeleportShmHeader);
+	return true;
+}
+#endif
+
+TeleportShmSegment* TeleportShmSegment::create(std::string label, float sampleRate, int numPorts) {
+#ifndef ARCH_WIN
+	if(label.size() > TELEPORT_SHM_MAX_LABEL) {
+		return NULL;
+	}
+	std::string name = getName(label);
+	int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	if(fd < 0 && errno == EEXIST) {
+		// Someone else has this label. If the process that created it isn't
+		// running anymore, the segment was left behind by a crash, take it
+		// over. kill() also fails with EPERM for a running process of another
+		// user. A header that doesn't validate may still be being written by
+		// another process creating the segment right now, so that counts as
+		// taken too.
+		TeleportShmSegment *existing = open(label);
+		const bool stale = existing && kill(existing->header->pid, 0) != 0 && errno == ESRCH;
+		delete existing;
+		if(!stale) {
+			return NULL;
+		}
+		shm_unlink(name.c_str());
+		fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	}
+	if(fd < 0) {
+		return NULL;
+	}
+
+	TeleportShmSegment *s = new TeleportShmSegment();
+	s->name = name;
+	s->owner = true;
+	s->fd = fd;
+	const size_t size = getSegmentSize(numPorts);
+	if(ftruncate(fd, size) != 0 || !mapSegment(s, size, PROT_READ | PROT_WRITE)) {
+		delete s;
+		return NULL;
+	}
+	s->numPorts = numPorts;
+	s->slotSize = getSlotSize(numPorts);
+	// ftruncate zero-fills the segment, so all slots and the write index
+	// start out at zero
+	s->header->capacity = TELEPORT_SHM_CAPACITY;
+	s->header->numPorts = numPorts;
+	s->header->pid = getpid();
+	s->header->session = random::u64();
+	s->header->sampleRate = sampleRate;
+	std::memcpy(s->header->label, label.c_str(), label.size() + 1);
+	s->header->layoutVersion = TELEPORT_SHM_LAYOUT_VERSION;
+	// readers check magic last
+	std::atomic_thread_fence(std::memory_order_release);
+	s->header->magic = TELEPORT_SHM_MAGIC;
+	return s;
+#else
+	return NULL;
+#endif
+}
+
+TeleportShmSegment* TeleportShmSegment::open(std::string label) {
+	TeleportShmSegment *s = openName(getName(label));
+	// a different label with the same hash
+	if(s && label != s->header->label) {
+		delete s;
+		return NULL;
+	}
+	return s;
+}
+
+TeleportShmSegment* TeleportShmSegment::openName(std::string name) {
+#ifndef ARCH_WIN
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if(fd < 0) {
+		return NULL;
+	}
+	TeleportShmSegment *s = new TeleportShmSegment();
+	s->name = name;
+	s->fd = fd;
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(TeleportShmHeader) || !mapSegment(s, st.st_size, PROT_READ)) {
+		delete s;
+		return NULL;
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if(s->header->magic != TELEPORT_SHM_MAGIC
+			|| s->header->layoutVersion != TELEPORT_SHM_LAYOUT_VERSION
+			|| s->header->capacity != TELEPORT_SHM_CAPACITY
+			|| s->header->numPorts > TELEPORT_MAX_PORTS
+			|| s->size < getSegmentSize(s->header->numPorts)
+			|| !std::memchr(s->header->label, 0, sizeof(s->header->label))) {
+		delete s;
+		return NULL;
+	}
+	s->numPorts = s->header->numPorts;
+	s->slotSize = getSlotSize(s->numPorts);
+	return s;
+#else
+	return NULL;
+#endif
+}
+
+void TeleportShmWriter::write(const TeleportFrame *frame) {
+	TeleportShmHeader *h = segment->header;
+	const uint64_t index = h->writeIndex.load(std::memory_order_relaxed);
+	TeleportShmSlot *slot = segment->getSlot(index);
+	TeleportShmPort *ports = slot->getPorts();
+
+	slot->sequence.store(2 * index + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	for(int i = 0; i < segment->numPorts; i++) {
+		const int channels = frame->channels[i];
+		ports[i].channels = channels;
+		copyVoltages(ports[i].voltages, frame->voltages[i], channels);
+	}
+	slot->sequence.store(2 * index + 2, std::memory_order_release);
+	h->writeIndex.store(index + 1, std::memory_order_release);
+}
+
+void TeleportShmReader::resync(uint64_t writeIndex, int latency) {
+	readIndex = writeIndex > (uint64_t) latency ? writeIndex - latency : 0;
+	started = true;
+}
+
+void TeleportShmReader::read(Output *outputs, int numOutputs, int latency, int underrunPolicy, int driftPolicy) {
+	const int numPorts = std::min(segment->numPorts, numOutputs);
+	const uint64_t writeIndex = segment->header->writeIndex.load(std::memory_order_acquire);
+	if(!started) {
+		resync(writeIndex, latency);
+	}
+
+	// frames available to read, negative if the writer restarted from zero
+	const int64_t distance = (int64_t) (writeIndex - readIndex);
+	// allow the distance to wander by this much before correcting it
+	const int64_t tolerance = std::max(latency / 4, 16);
+	bool advance = true;
+
+	if(distance <= 0) {
+		if(distance < 0) {
+			stats.increment(stats.resyncs);
+			resync(writeIndex, latency);
+		}
+		stats.increment(stats.underruns);
+		if(underrunPolicy == UNDERRUN_SILENCE) {
+			for(int i = 0; i < numPorts; i++) {
+				outputs[i].setChannels(1);
+				outputs[i].setVoltage(0.f);
+			}
+		}
+		return;
+	} else if(distance >= TELEPORT_SHM_CAPACITY) {
+		// the writer has already overwritten the frame we wanted to read
+		stats.increment(stats.overruns);
+		resync(writeIndex, latency);
+	} else if(distance > latency + tolerance) {
+		if(driftPolicy == DRIFT_SLIP) {
+			stats.increment(stats.slips);
+			readIndex++;
+		} else {
+			stats.increment(stats.resyncs);
+			resync(writeIndex, latency);
+		}
+	} else if(distance < latency - tolerance) {
+		if(driftPolicy == DRIFT_SLIP) {
+			// read the same frame again next time
+			stats.increment(stats.slips);
+			advance = false;
+		} else {
+			stats.increment(stats.resyncs);
+			resync(writeIndex, latency);
+			return;
+		}
+	}
+
+	TeleportShmSlot *slot = segment->getSlot(readIndex);
+	const TeleportShmPort *ports = slot->getPorts();
+	const uint64_t expected = 2 * readIndex + 2;
+	if(slot->sequence.load(std::memory_order_acquire) != expected) {
+		stats.increment(stats.overruns);
+		resync(writeIndex, latency);
+		return;
+	}
+	// copy to our own frame first, the outputs are only touched once we know
+	// the frame isn't torn
+	for(int i = 0; i < numPorts; i++) {
+		frame.channels[i] = clamp((int) ports[i].channels, 0, MAX_POLY_CHANNELS);
+		copyVoltages(frame.voltages[i], ports[i].voltages, frame.channels[i]);
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if(slot->sequence.load(std::memory_order_relaxed) != expected) {
+		// the writer lapped us while we were copying
+		stats.increment(stats.overruns);
+		resync(writeIndex, latency);
+		return;
+	}
+	for(int i = 0; i < numPorts; i++) {
+		channels[i] = frame.channels[i];
+		outputs[i].setChannels(frame.channels[i]);
+		copyVoltages(outputs[i].getVoltages(), frame.voltages[i], frame.channels[i]);
+	}
+
+	stats.increment(stats.framesRead);
+	if(advance) {
+		readIndex++;
+	}
+}
+
+bool TeleportShmReader::isCurrent() {
+#ifndef ARCH_WIN
+	// compare against whatever is currently published under our name
+	int fd = shm_open(segment->name.c_str(), O_RDONLY, 0);
+	if(fd < 0) {
+		return false;
+	}
+	// Map only the header. Not read(), macOS doesn't support that on shared
+	// memory objects.
+	struct stat st;
+	bool current = false;
+	if(fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(TeleportShmHeader)) {
+		void *mem = mmap(NULL, sizeof(TeleportShmHeader), PROT_READ, MAP_SHARED, fd, 0);
+		if(mem != MAP_FAILED) {
+			current = ((const TeleportShmHeader*) mem)->session == segment->header->session;
+			munmap(mem, sizeof(TeleportShmHeader));
+		}
+	}
+	close(fd);
+	return current;
+#else
+	return false;
+#endif
+}
+
+std::vector<std::string> getSharedTeleportLabels() {
+	std::vector<std::string> labels;
+#if defined ARCH_LIN
+	// Only Linux exposes the shared memory objects as files
+	DIR *dir = opendir("/dev/shm");
+	if(!dir) {
+		return labels;
+	}
+	while(struct dirent *entry = readdir(dir)) {
+		std::string name = entry->d_name;
+		if(name.compare(0, TELEPORT_SHM_PREFIX.size(), TELEPORT_SHM_PREFIX) != 0) {
+			continue;
+		}
+		// the name only has a hash, the label is in the header
+		TeleportShmSegment *s = TeleportShmSegment::openName("/" + name);
+		if(s) {
+			labels.push_back(s->header->label);
+			delete s;
+		}
+	}
+	closedir(dir);
+	std::sort(labels.begin(), labels.end());
+#endif
+	return labels;
+}
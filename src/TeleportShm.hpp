@@ -0,0 +1,139 @@
+#pragma once
+#include "Teleport.hpp"
+
+// Sharing teleport sources between Rack instances running on the same
+// machine, through POSIX shared memory. Each shared source gets its own
+// segment holding a ring buffer of frames. The source writes one frame per
+// sample and any number of outputs in other processes read from it, without
+// locks on either side.
+//
+// Not available on Windows, the functions below just fail there.
+
+#define TELEPORT_SHM_CAPACITY 4096 // frames in the ring buffer, must be a power of two
+#define TELEPORT_SHM_MAX_LABEL 255 // bytes, longer labels can't be shared
+
+struct TeleportShmPort {
+	int32_t channels;
+	float voltages[MAX_POLY_CHANNELS];
+};
+
+// One frame of the ring buffer, followed by numPorts TeleportShmPorts. The
+// number of ports is set by the source, so the size of a slot is only known
+// at runtime, see TeleportShmSegment::getSlot().
+struct TeleportShmSlot {
+	// 2 * index + 1 while frame number index is being written into this
+	// slot, 2 * index + 2 once it's complete. Readers check this before and
+	// after copying the frame to detect torn or overwritten frames.
+	std::atomic<uint64_t> sequence;
+
+	inline TeleportShmPort* getPorts() {
+		return (TeleportShmPort*) (this + 1);
+	}
+};
+
+struct TeleportShmHeader {
+	uint32_t magic;
+	uint32_t layoutVersion;
+	uint32_t capacity;
+	uint32_t numPorts;
+	int32_t pid; // of the writer, used for detecting segments left behind by a crash
+	uint64_t session; // random, changes every time the segment is recreated
+	float sampleRate; // of the writer, for display only
+	// The segment name only has a hash of the label, since macOS limits
+	// names to 31 characters. NUL-terminated.
+	char label[TELEPORT_SHM_MAX_LABEL + 1];
+	std::atomic<uint64_t> writeIndex; // number of frames written so far
+};
+
+// An mmapped segment. Owners create the segment and unlink it on destruction.
+struct TeleportShmSegment {
+	std::string name;
+	bool owner = false;
+	int fd = -1;
+	void *mem = NULL;
+	size_t size = 0;
+	TeleportShmHeader *header = NULL;
+	char *slots = NULL;
+	int numPorts = 0;
+	size_t slotSize = 0;
+
+	~TeleportShmSegment();
+
+	// Remove the name of an owned segment, the mapping stays valid.
+	void unlink();
+
+	// Return NULL on failure, e.g. if another running process already
+	// shares the same label.
+	static TeleportShmSegment* create(std::string label, float sampleRate, int numPorts);
+	static TeleportShmSegment* open(std::string label);
+	// Open the segment with the given name, whatever its label.
+	static TeleportShmSegment* openName(std::string name);
+
+	static std::string getName(std::string label);
+	static size_t getSlotSize(int numPorts);
+
+	inline TeleportShmSlot* getSlot(uint64_t index) {
+		return (TeleportShmSlot*) (slots + (index & (TELEPORT_SHM_CAPACITY - 1)) * slotSize);
+	}
+};
+
+struct TeleportShmWriter {
+	TeleportShmSegment *segment;
+
+	TeleportShmWriter(TeleportShmSegment *s) : segment(s) {}
+	~TeleportShmWriter() { delete segment; }
+
+	// Called from the source's process(), once per sample, with the frame it
+	// has just published.
+	void write(const TeleportFrame *frame);
+};
+
+enum TeleportShmUnderrunPolicy {
+	UNDERRUN_HOLD, // keep outputting the last frame
+	UNDERRUN_SILENCE,
+	NUM_UNDERRUN_POLICIES
+};
+
+enum TeleportShmDriftPolicy {
+	DRIFT_SLIP, // skip or repeat single frames to stay within the latency budget
+	DRIFT_RESYNC, // jump straight back to the target latency
+	NUM_DRIFT_POLICIES
+};
+
+// Counters are only written by the engine thread of the reader, and read by
+// the GUI for display.
+struct TeleportShmStats : TeleportCounters {
+	std::atomic<uint64_t> framesRead{0};
+	std::atomic<uint64_t> underruns{0};
+	std::atomic<uint64_t> overruns{0};
+	std::atomic<uint64_t> slips{0};
+	std::atomic<uint64_t> resyncs{0};
+};
+
+struct TeleportShmReader {
+	TeleportShmSegment *segment;
+	uint64_t readIndex = 0;
+	bool started = false;
+	TeleportShmStats stats;
+	// channel counts of the last frame read, for the lights
+	int channels[TELEPORT_MAX_PORTS] = {};
+	// a frame is copied here first, until we know it isn't torn
+	TeleportFrame frame;
+
+	TeleportShmReader(TeleportShmSegment *s) : segment(s) {}
+	~TeleportShmReader() { delete segment; }
+
+	// Called from the output's process(), once per sample. latency is the
+	// target distance in frames behind the writer. Ports that the source
+	// doesn't have are left alone.
+	void read(Output *outputs, int numOutputs, int latency, int underrunPolicy, int driftPolicy);
+
+	// Whether the segment we have mapped is still the one published under
+	// the label, i.e. the writer hasn't restarted. GUI thread only.
+	bool isCurrent();
+
+	void resync(uint64_t writeIndex, int latency);
+};
+
+// Labels of all teleport sources shared by any process on this machine.
+std::vector<std::string> getSharedTeleportLabels();
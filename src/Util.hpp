@@ -2,7 +2,7 @@
 
 #include "rack.hpp"
 #include <chrono> // std::chrono
-#include <algorithm> // std::generate_n
+#include <algorithm>
 
 using namespace rack;
 
@@ -23,9 +23,6 @@ TinyLight<TLightColor> *createTinyLightForPort(Vec portCenterPos, Module *module
 			module, firstLightId);
 }
 
-// generate random alphanumeric string
-std::string randomString(size_t len);
-
 struct GUITimer {
 	// Kinda like dsp::PulseGenerator, but uses std::chrono for timing events, since
 	// we don't have args.sampleTime for Widget::step().